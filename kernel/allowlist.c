@@ -1,13 +1,28 @@
 #include "ksu.h"
+#include "linux/anon_inodes.h"
 #include "linux/compiler.h"
+#include "linux/crc32.h"
 #include "linux/fs.h"
 #include "linux/gfp.h"
+#include "linux/hashtable.h"
+#include "linux/jhash.h"
 #include "linux/kernel.h"
+#include "linux/kref.h"
+#include "linux/ktime.h"
 #include "linux/list.h"
+#include "linux/poll.h"
 #include "linux/printk.h"
+#include "linux/radix-tree.h"
+#include "linux/rculist.h"
+#include "linux/rcupdate.h"
 #include "linux/slab.h"
+#include "linux/sort.h"
+#include "linux/string.h"
 #include "linux/types.h"
+#include "linux/user_namespace.h"
 #include "linux/version.h"
+#include "linux/vmalloc.h"
+#include "linux/wait.h"
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 14, 0)
 #include "linux/compiler_types.h"
 #endif
@@ -16,93 +31,668 @@
 #include "selinux/selinux.h"
 #include "kernel_compat.h"
 #include "allowlist.h"
+#include "core_hook.h"
+#include "profile_tlv.h"
 
 #define FILE_MAGIC 0x7f4b5355 // ' KSU', u32
-#define FILE_FORMAT_VERSION 3 // u32
+#define FILE_FORMAT_VERSION 4 // u32
+// version 3 and older store raw app_profile records one after another
+#define FILE_FORMAT_VERSION_LEGACY 3
 
 #define KSU_APP_PROFILE_PRESERVE_UID 9999 // NOBODY_UID
 #define KSU_DEFAULT_SELINUX_DOMAIN "u:r:su:s0"
 
+// serializes all writers, readers walk the list and hash tables under RCU
 static DEFINE_MUTEX(allowlist_mutex);
 
 // default profiles, these may be used frequently, so we cache it
-static struct root_profile default_root_profile;
+static struct root_profile_holder __rcu *default_root_profile;
 static struct non_root_profile default_non_root_profile;
+// the `$` profile, for its umount paths which can't be read with READ_ONCE
+static struct perm_data __rcu *default_non_root_perm;
 
-static int allow_list_arr[PAGE_SIZE / sizeof(int)] __read_mostly __aligned(PAGE_SIZE);
-static int allow_list_pointer __read_mostly = 0;
+static void free_root_profile_holder_rcu(struct rcu_head *rcu)
+{
+	struct root_profile_holder *holder =
+		container_of(rcu, struct root_profile_holder, rcu);
+
+	if (holder->groups)
+		put_group_info(holder->groups);
+	kfree(holder);
+}
 
-static void remove_uid_from_arr(uid_t uid)
+static void release_root_profile_holder(struct kref *ref)
 {
-	int *temp_arr;
-	int i, j;
+	struct root_profile_holder *holder =
+		container_of(ref, struct root_profile_holder, ref);
 
-	if (allow_list_pointer == 0)
-		return;
+	// lockless readers may still be looking at it
+	call_rcu(&holder->rcu, free_root_profile_holder_rcu);
+}
 
-	temp_arr = kmalloc(sizeof(allow_list_arr), GFP_KERNEL);
-	if (temp_arr == NULL) {
-		pr_err("%s: unable to allocate memory\n", __func__);
-		return;
-	}
+void ksu_put_root_profile_holder(struct root_profile_holder *holder)
+{
+	kref_put(&holder->ref, release_root_profile_holder);
+}
 
-	for (i = j = 0; i < allow_list_pointer; i++) {
-		if (allow_list_arr[i] == uid)
-			continue;
-		temp_arr[j++] = allow_list_arr[i];
-	}
+// the groups and the sid are prepared here once instead of for each grant
+static struct root_profile_holder *
+new_root_profile_holder(const struct root_profile *profile)
+{
+	struct root_profile_holder *holder = kmalloc(sizeof(*holder), GFP_KERNEL);
 
-	allow_list_pointer = j;
+	if (!holder)
+		return NULL;
 
-	for (; j < ARRAY_SIZE(allow_list_arr); j++)
-		temp_arr[j] = -1;
+	kref_init(&holder->ref);
+	memcpy(&holder->profile, profile, sizeof(holder->profile));
+	holder->groups = ksu_alloc_root_groups(profile, &init_user_ns);
+	// the domain may not exist until the policy is loaded or patched, so
+	// it is resolved by the first grant
+	holder->sid = 0;
 
-	memcpy(&allow_list_arr, temp_arr, PAGE_SIZE);
-	kfree(temp_arr);
+	return holder;
 }
 
 static void init_default_profiles()
 {
-	default_root_profile.uid = 0;
-	default_root_profile.gid = 0;
-	default_root_profile.groups_count = 1;
-	default_root_profile.groups[0] = 0;
-	memset(&default_root_profile.capabilities, 0xff,
-	       sizeof(default_root_profile.capabilities));
-	default_root_profile.namespaces = 0;
-	strcpy(default_root_profile.selinux_domain, KSU_DEFAULT_SELINUX_DOMAIN);
+	struct root_profile profile;
+	struct root_profile_holder *holder = NULL;
+
+	memset(&profile, 0, sizeof(profile));
+	profile.uid = 0;
+	profile.gid = 0;
+	profile.groups_count = 1;
+	profile.groups[0] = 0;
+	memset(&profile.capabilities, 0xff, sizeof(profile.capabilities));
+	profile.namespaces = 0;
+	strcpy(profile.selinux_domain, KSU_DEFAULT_SELINUX_DOMAIN);
+
+	holder = new_root_profile_holder(&profile);
+	if (!holder) {
+		pr_err("init default root profile alloc failed\n");
+		return;
+	}
+	rcu_assign_pointer(default_root_profile, holder);
 
 	// This means that we will umount modules by default!
 	default_non_root_profile.umount_modules = true;
 }
 
+/*
+ * Root profiles are interned: apps using the same template, or the very same
+ * profile without a template, share one refcounted entry. The profile itself
+ * is published through an RCU holder, so updating a template changes it for
+ * every app using it at once.
+ */
+struct interned_root_profile {
+	struct hlist_node node;
+	struct rcu_head rcu;
+	// protected by allowlist_mutex
+	u32 refs;
+	u32 hash;
+	// template name, empty if the profile doesn't come from a template
+	char name[KSU_MAX_PACKAGE_NAME];
+	struct root_profile_holder __rcu *holder;
+};
+
+#define ROOT_PROFILE_HASH_BITS 6
+static DEFINE_HASHTABLE(root_profile_table, ROOT_PROFILE_HASH_BITS);
+static u32 root_profile_count;
+
 struct perm_data {
 	struct list_head list;
+	// indexed by uid, entries keep their insertion order in each bucket
+	struct hlist_node uid_node;
+	// indexed by uid + package, used to find the entry to override
+	struct hlist_node key_node;
+	struct rcu_head rcu;
+	// shared root profile if allow_su, it never changes for this entry
+	struct interned_root_profile *root;
+	// only the head of the profile is stored, up to the non root profile,
+	// the root profile and template name are in root, see copy_app_profile
 	struct app_profile profile;
 };
 
+#define PERM_DATA_PROFILE_SIZE                                                 \
+	(offsetof(struct app_profile, nrp_config.profile) +                    \
+	 sizeof(struct non_root_profile))
+#define PERM_DATA_SIZE                                                         \
+	(offsetof(struct perm_data, profile) + PERM_DATA_PROFILE_SIZE)
+
+// keeps the insertion order, used when we need to walk all the profiles
 static struct list_head allow_list;
+static u32 allow_list_count;
+// bumped on every change so the manager can skip refetching an unchanged list
+static u32 allow_list_generation = 1;
+// woken up when the generation changes, see ksu_allow_list_notify_fd
+static DECLARE_WAIT_QUEUE_HEAD(allow_list_waitq);
+
+#define ALLOW_LIST_HASH_BITS 8
+static DEFINE_HASHTABLE(allow_list_uid_table, ALLOW_LIST_HASH_BITS);
+static DEFINE_HASHTABLE(allow_list_key_table, ALLOW_LIST_HASH_BITS);
+
+static inline u32 profile_key_hash(uid_t uid, const char *key)
+{
+	return jhash(key, strnlen(key, KSU_MAX_PACKAGE_NAME), uid);
+}
+
+static inline struct hlist_head *uid_bucket(uid_t uid)
+{
+	return &allow_list_uid_table[hash_min(uid, ALLOW_LIST_HASH_BITS)];
+}
+
+// must be called with allowlist_mutex held
+static struct perm_data *find_perm_data_locked(uid_t uid, const char *key)
+{
+	struct perm_data *p = NULL;
+
+	hash_for_each_possible (allow_list_key_table, p, key_node,
+				profile_key_hash(uid, key)) {
+		if (p->profile.current_uid == uid &&
+		    !strcmp(p->profile.key, key)) {
+			return p;
+		}
+	}
+
+	return NULL;
+}
+
+// zero the padding and unused slots so that equal profiles compare equal
+static void canonical_root_profile(struct root_profile *dst,
+				   const struct root_profile *src)
+{
+	int groups_count = clamp(src->groups_count, 0, KSU_MAX_GROUPS);
+
+	memset(dst, 0, sizeof(*dst));
+	dst->uid = src->uid;
+	dst->gid = src->gid;
+	dst->groups_count = groups_count;
+	memcpy(dst->groups, src->groups, groups_count * sizeof(src->groups[0]));
+	dst->capabilities.effective = src->capabilities.effective;
+	dst->capabilities.permitted = src->capabilities.permitted;
+	dst->capabilities.inheritable = src->capabilities.inheritable;
+	strscpy(dst->selinux_domain, src->selinux_domain,
+		sizeof(dst->selinux_domain));
+	dst->namespaces = src->namespaces;
+}
+
+static u32 root_profile_hash(const char *name,
+			     const struct root_profile *profile)
+{
+	if (name[0])
+		return jhash(name, strnlen(name, KSU_MAX_PACKAGE_NAME), 0);
+
+	return jhash(profile, sizeof(*profile), 0);
+}
+
+static inline struct root_profile_holder *
+interned_holder_locked(struct interned_root_profile *root)
+{
+	return rcu_dereference_protected(root->holder,
+					 lockdep_is_held(&allowlist_mutex));
+}
+
+// must be called with allowlist_mutex held, profile must be canonical
+static bool set_interned_profile_locked(struct interned_root_profile *root,
+					const struct root_profile *profile)
+{
+	struct root_profile_holder *old = interned_holder_locked(root);
+	struct root_profile_holder *holder = new_root_profile_holder(profile);
+
+	if (!holder)
+		return false;
+
+	rcu_assign_pointer(root->holder, holder);
+	if (old)
+		ksu_put_root_profile_holder(old);
+
+	return true;
+}
+
+// must be called with allowlist_mutex held
+static struct interned_root_profile *
+find_interned_template_locked(const char *name)
+{
+	struct interned_root_profile *root = NULL;
+
+	hash_for_each_possible (root_profile_table, root, node,
+				root_profile_hash(name, NULL)) {
+		if (!strncmp(root->name, name, sizeof(root->name)))
+			return root;
+	}
+
+	return NULL;
+}
+
+/*
+ * Get a reference to the interned entry of the profile, must be called with
+ * allowlist_mutex held. For a template the latest profile wins, which updates
+ * the profile of all the apps using that template.
+ */
+static struct interned_root_profile *
+intern_root_profile_locked(const char *name, const struct root_profile *src)
+{
+	struct interned_root_profile *root = NULL;
+	struct root_profile profile;
+	u32 hash;
+
+	canonical_root_profile(&profile, src);
+	hash = root_profile_hash(name, &profile);
+
+	hash_for_each_possible (root_profile_table, root, node, hash) {
+		if (root->hash != hash ||
+		    strncmp(root->name, name, sizeof(root->name)))
+			continue;
+
+		if (memcmp(&interned_holder_locked(root)->profile, &profile,
+			   sizeof(profile))) {
+			if (!name[0])
+				continue;
+			// keep the old one if we can't allocate
+			set_interned_profile_locked(root, &profile);
+		}
+		root->refs++;
+		return root;
+	}
+
+	root = kzalloc(sizeof(*root), GFP_KERNEL);
+	if (!root)
+		return NULL;
+
+	if (!set_interned_profile_locked(root, &profile)) {
+		kfree(root);
+		return NULL;
+	}
+	root->refs = 1;
+	root->hash = hash;
+	strscpy(root->name, name, sizeof(root->name));
+	hash_add_rcu(root_profile_table, &root->node, hash);
+	root_profile_count++;
+
+	return root;
+}
+
+// must be called with allowlist_mutex held
+static void put_root_profile_locked(struct interned_root_profile *root)
+{
+	struct root_profile_holder *holder = NULL;
+
+	if (--root->refs)
+		return;
+
+	holder = interned_holder_locked(root);
+	hash_del_rcu(&root->node);
+	ksu_put_root_profile_holder(holder);
+	kfree_rcu(root, rcu);
+	root_profile_count--;
+}
+
+// byte order, the umount relies on it to stop early, see canonical_umount_paths
+static int cmp_umount_path(const void *a, const void *b)
+{
+	return strcmp(a, b);
+}
+
+/*
+ * Sort the umount paths and drop the invalid or duplicated ones, so that the
+ * umount can stop at the first path greater than the mount point. The paths
+ * are stored without the trailing '/', except for "/" itself.
+ */
+static void canonical_umount_paths(struct non_root_profile *profile)
+{
+	char(*paths)[KSU_UMOUNT_PATH_MAX] = profile->umount_paths;
+	u8 count = min_t(u8, profile->umount_paths_count, KSU_MAX_UMOUNT_PATHS);
+	u8 valid = 0;
+	u8 i;
+
+	for (i = 0; i < count; i++) {
+		char *path = paths[i];
+		size_t len = strnlen(path, KSU_UMOUNT_PATH_MAX - 1);
+
+		path[len] = '\0';
+		while (len > 1 && path[len - 1] == '/')
+			path[--len] = '\0';
+		if (path[0] != '/')
+			continue;
+		if (valid != i)
+			memcpy(paths[valid], path, KSU_UMOUNT_PATH_MAX);
+		valid++;
+	}
+
+	sort(paths, valid, KSU_UMOUNT_PATH_MAX, cmp_umount_path, NULL);
+
+	count = valid;
+	valid = 0;
+	for (i = 0; i < count; i++) {
+		if (valid && !strcmp(paths[valid - 1], paths[i]))
+			continue;
+		if (valid != i)
+			memcpy(paths[valid], paths[i], KSU_UMOUNT_PATH_MAX);
+		valid++;
+	}
+
+	memset(paths[valid], 0, (KSU_MAX_UMOUNT_PATHS - valid) * KSU_UMOUNT_PATH_MAX);
+	profile->umount_paths_count = valid;
+}
+
+static struct perm_data *new_perm_data_locked(const struct app_profile *profile)
+{
+	struct perm_data *p = kmalloc(PERM_DATA_SIZE, GFP_KERNEL);
+
+	if (!p)
+		return NULL;
+
+	memcpy(&p->profile, profile, PERM_DATA_PROFILE_SIZE);
+	p->root = NULL;
+	if (!profile->allow_su) {
+		canonical_umount_paths(&p->profile.nrp_config.profile);
+	} else {
+		p->root = intern_root_profile_locked(
+			profile->rp_config.template_name,
+			&profile->rp_config.profile);
+		if (!p->root) {
+			kfree(p);
+			return NULL;
+		}
+	}
+
+	return p;
+}
+
+// must be called with allowlist_mutex held, after p is unlinked or if it was
+// never inserted
+static void free_perm_data_locked(struct perm_data *p)
+{
+	if (p->root)
+		put_root_profile_locked(p->root);
+	kfree_rcu(p, rcu);
+}
+
+// must be called under rcu_read_lock or with allowlist_mutex held
+static void copy_app_profile(struct app_profile *dst, const struct perm_data *p)
+{
+	struct root_profile_holder *holder = NULL;
+
+	memcpy(dst, &p->profile, PERM_DATA_PROFILE_SIZE);
+	memset((char *)dst + PERM_DATA_PROFILE_SIZE, 0,
+	       sizeof(*dst) - PERM_DATA_PROFILE_SIZE);
+	if (!p->profile.allow_su)
+		return;
+
+	memcpy(dst->rp_config.template_name, p->root->name,
+	       sizeof(dst->rp_config.template_name));
+	holder = rcu_dereference_check(p->root->holder,
+				       lockdep_is_held(&allowlist_mutex));
+	memcpy(&dst->rp_config.profile, &holder->profile,
+	       sizeof(dst->rp_config.profile));
+}
+
+// shared with the inline fast path in allowlist.h, never has a forbidden uid
+uint8_t ksu_allow_list_bitmap[PAGE_SIZE] __read_mostly __aligned(PAGE_SIZE);
+#define BITMAP_UID_MAX KSU_BITMAP_UID_MAX
+
+/*
+ * uids above BITMAP_UID_MAX (secondary users and work profiles, whose uid is
+ * userId * PER_USER_RANGE + appId) are kept in a bitmap per android user.
+ * The bitmaps are allocated lazily when the first uid of a user is granted,
+ * looked up by user id under RCU and only freed on exit.
+ */
+#define PER_USER_RANGE 100000
+
+struct user_allow_bitmap {
+	struct rcu_head rcu;
+	struct list_head list;
+	u32 user_id;
+	DECLARE_BITMAP(bits, PER_USER_RANGE);
+};
 
-static uint8_t allow_list_bitmap[PAGE_SIZE] __read_mostly __aligned(PAGE_SIZE);
-#define BITMAP_UID_MAX ((sizeof(allow_list_bitmap) * BITS_PER_BYTE) - 1)
+static RADIX_TREE(allow_list_users, GFP_KERNEL);
+static LIST_HEAD(allow_list_user_bitmaps);
+
+static bool is_uid_in_user_bitmap(uid_t uid)
+{
+	struct user_allow_bitmap *bitmap;
+	bool allowed;
+
+	rcu_read_lock();
+	bitmap = radix_tree_lookup(&allow_list_users, uid / PER_USER_RANGE);
+	allowed = bitmap && test_bit(uid % PER_USER_RANGE, bitmap->bits);
+	rcu_read_unlock();
+
+	return allowed;
+}
+
+// must be called with allowlist_mutex held, NULL if it is missing and either
+// create is false or the allocation failed
+static struct user_allow_bitmap *get_user_bitmap_locked(uid_t uid, bool create)
+{
+	u32 user_id = uid / PER_USER_RANGE;
+	struct user_allow_bitmap *bitmap =
+		radix_tree_lookup(&allow_list_users, user_id);
+
+	if (bitmap || !create)
+		return bitmap;
+
+	bitmap = kzalloc(sizeof(*bitmap), GFP_KERNEL);
+	if (!bitmap) {
+		pr_err("alloc allowlist bitmap for user %d failed\n", user_id);
+		return NULL;
+	}
+	bitmap->user_id = user_id;
+	if (radix_tree_insert(&allow_list_users, user_id, bitmap)) {
+		pr_err("insert allowlist bitmap for user %d failed\n", user_id);
+		kfree(bitmap);
+		return NULL;
+	}
+	list_add_tail(&bitmap->list, &allow_list_user_bitmaps);
+
+	return bitmap;
+}
+
+/*
+ * Must be called with allowlist_mutex held. Allowing a uid needs the bitmap
+ * of its user allocated first by get_user_bitmap_locked, so this can't fail.
+ */
+static void set_user_bitmap_locked(uid_t uid, bool allow)
+{
+	struct user_allow_bitmap *bitmap = get_user_bitmap_locked(uid, false);
+
+	// nothing granted for this user yet
+	if (!bitmap)
+		return;
+
+	if (allow)
+		set_bit(uid % PER_USER_RANGE, bitmap->bits);
+	else
+		clear_bit(uid % PER_USER_RANGE, bitmap->bits);
+}
+
+/*
+ * Precomputed answer of ksu_uid_should_umount for every uid covered by
+ * ksu_allow_list_bitmap, 2 bits per uid, so that the setuid hook of every app
+ * launch only needs a single read instead of walking the profiles.
+ * KSU_VERDICT_DEFAULT defers to the default non root profile, so changing
+ * the `$` profile doesn't need to touch this table.
+ */
+#define KSU_VERDICT_DEFAULT 0
+#define KSU_VERDICT_ALLOW_SU 1
+#define KSU_VERDICT_UMOUNT 2
+#define KSU_VERDICT_NO_UMOUNT 3
+
+#define KSU_VERDICT_BITS 2
+#define KSU_VERDICT_MASK ((1 << KSU_VERDICT_BITS) - 1)
+#define KSU_VERDICTS_PER_BYTE (BITS_PER_BYTE / KSU_VERDICT_BITS)
+
+static uint8_t allow_list_verdict[(BITMAP_UID_MAX + 1) / KSU_VERDICTS_PER_BYTE]
+	__read_mostly __aligned(PAGE_SIZE);
+
+static inline u8 get_uid_verdict(uid_t uid)
+{
+	u8 byte = READ_ONCE(allow_list_verdict[uid / KSU_VERDICTS_PER_BYTE]);
+	return (byte >> ((uid % KSU_VERDICTS_PER_BYTE) * KSU_VERDICT_BITS)) &
+	       KSU_VERDICT_MASK;
+}
+
+static u8 profile_verdict(const struct app_profile *profile)
+{
+	if (profile->allow_su) {
+		// granted to su, we shouldn't umount for it
+		return KSU_VERDICT_NO_UMOUNT;
+	}
+	if (profile->nrp_config.use_default) {
+		return KSU_VERDICT_DEFAULT;
+	}
+	return profile->nrp_config.profile.umount_modules ?
+		       KSU_VERDICT_UMOUNT :
+		       KSU_VERDICT_NO_UMOUNT;
+}
+
+// must be called with allowlist_mutex held, after the bitmap is updated
+static void update_uid_verdict_locked(uid_t uid)
+{
+	struct perm_data *p = NULL;
+	u8 verdict = KSU_VERDICT_DEFAULT;
+	u8 shift;
+	u8 byte;
+
+	if (uid > BITMAP_UID_MAX)
+		return;
+
+	if (ksu_allow_list_bitmap[uid / BITS_PER_BYTE] & (1 << (uid % BITS_PER_BYTE))) {
+		verdict = KSU_VERDICT_ALLOW_SU;
+	} else {
+		// the first profile of the uid wins, the same as ksu_get_app_profile
+		hlist_for_each_entry (p, uid_bucket(uid), uid_node) {
+			if (p->profile.current_uid == uid) {
+				verdict = profile_verdict(&p->profile);
+				break;
+			}
+		}
+	}
+
+	shift = (uid % KSU_VERDICTS_PER_BYTE) * KSU_VERDICT_BITS;
+	byte = allow_list_verdict[uid / KSU_VERDICTS_PER_BYTE];
+	byte &= ~(KSU_VERDICT_MASK << shift);
+	byte |= verdict << shift;
+	WRITE_ONCE(allow_list_verdict[uid / KSU_VERDICTS_PER_BYTE], byte);
+}
 
 #define KERNEL_SU_ALLOWLIST "/data/adb/ksu/.allowlist"
 
-static struct work_struct ksu_save_work;
+/*
+ * Since FILE_FORMAT_VERSION 4 the allowlist file is an append-only journal:
+ * the header is followed by records which are replayed in order when loading.
+ * Every record carries a crc32 of its type, size and payload chained with the
+ * crc of the previous record, so a torn or corrupted tail is detected.
+ * The journal is compacted (rewritten with the live profiles only) when it
+ * grows much larger than the allowlist itself.
+ */
+#define KSU_RECORD_SET_PROFILE 1 // struct app_profile
+#define KSU_RECORD_DELETE_PROFILE 2 // struct allowlist_delete_record
+#define KSU_RECORD_SET_PROFILE_TLV 3 // app_profile encoded by profile_tlv
+
+struct allowlist_record {
+	u32 type;
+	u32 size; // size of the payload following this header
+	u32 crc;
+};
+
+struct allowlist_delete_record {
+	int32_t current_uid;
+	char key[KSU_MAX_PACKAGE_NAME];
+};
+
+#define KSU_JOURNAL_COMPACT_SLACK 64
+// wait a bit before saving so that a burst of changes is written at once
+#define KSU_SAVE_DELAY_MS 500
+
+// changes not written yet, protected by allowlist_mutex
+struct allowlist_change {
+	struct list_head list;
+	u32 type;
+	struct app_profile profile;
+};
+static LIST_HEAD(pending_changes);
+static bool compact_pending;
+
+/*
+ * State of the journal file, only touched by the save and load works which
+ * are serialized by the ordered ksu workqueue.
+ * journal_size being 0 means the file must be rewritten from scratch.
+ */
+static loff_t journal_size;
+static u32 journal_crc;
+static u32 journal_records;
+
+static struct delayed_work ksu_save_work;
 static struct work_struct ksu_load_work;
 
 bool persistent_allow_list(void);
 
+// must be called with allowlist_mutex held
+static void bump_generation_locked(void)
+{
+	WRITE_ONCE(allow_list_generation, allow_list_generation + 1);
+	wake_up_interruptible(&allow_list_waitq);
+}
+
+// must be called with allowlist_mutex held
+static void queue_allowlist_change_locked(u32 type,
+					  const struct app_profile *profile)
+{
+	struct allowlist_change *change = kmalloc(sizeof(*change), GFP_KERNEL);
+	if (!change) {
+		// we can't journal it, rewrite the whole file instead
+		compact_pending = true;
+		return;
+	}
+
+	change->type = type;
+	if (type == KSU_RECORD_DELETE_PROFILE) {
+		// profile may be the head of a perm_data, don't read past it
+		memset(&change->profile, 0, sizeof(change->profile));
+		change->profile.current_uid = profile->current_uid;
+		strscpy(change->profile.key, profile->key,
+			sizeof(change->profile.key));
+	} else {
+		memcpy(&change->profile, profile, sizeof(change->profile));
+	}
+	list_add_tail(&change->list, &pending_changes);
+}
+
+// must be called with allowlist_mutex held
+static void remove_perm_data_locked(struct perm_data *p)
+{
+	uid_t uid = p->profile.current_uid;
+
+	list_del_rcu(&p->list);
+	hash_del_rcu(&p->uid_node);
+	hash_del_rcu(&p->key_node);
+	allow_list_count--;
+	bump_generation_locked();
+
+	if (likely(uid <= BITMAP_UID_MAX)) {
+		ksu_allow_list_bitmap[uid / BITS_PER_BYTE] &= ~(1 << (uid % BITS_PER_BYTE));
+	} else {
+		set_user_bitmap_locked(uid, false);
+	}
+	update_uid_verdict_locked(uid);
+	if (p == rcu_access_pointer(default_non_root_perm))
+		RCU_INIT_POINTER(default_non_root_perm, NULL);
+	free_perm_data_locked(p);
+}
+
 void ksu_show_allow_list(void)
 {
 	struct perm_data *p = NULL;
-	struct list_head *pos = NULL;
 	pr_info("ksu_show_allow_list\n");
-	list_for_each (pos, &allow_list) {
-		p = list_entry(pos, struct perm_data, list);
+	rcu_read_lock();
+	list_for_each_entry_rcu (p, &allow_list, list) {
 		pr_info("uid :%d, allow: %d\n", p->profile.current_uid,
 			p->profile.allow_su);
 	}
+	rcu_read_unlock();
 }
 
 #ifdef CONFIG_KSU_DEBUG
@@ -121,24 +711,51 @@ static void ksu_grant_root_to_shell()
 bool ksu_get_app_profile(struct app_profile *profile)
 {
 	struct perm_data *p = NULL;
-	struct list_head *pos = NULL;
+	uid_t uid = profile->current_uid;
 	bool found = false;
 
-	list_for_each (pos, &allow_list) {
-		p = list_entry(pos, struct perm_data, list);
-		bool uid_match = profile->current_uid == p->profile.current_uid;
-		if (uid_match) {
+	rcu_read_lock();
+	hlist_for_each_entry_rcu (p, uid_bucket(uid), uid_node) {
+		if (uid == p->profile.current_uid) {
 			// found it, override it with ours
-			memcpy(profile, &p->profile, sizeof(*profile));
+			copy_app_profile(profile, p);
 			found = true;
-			goto exit;
+			break;
 		}
 	}
+	rcu_read_unlock();
 
-exit:
 	return found;
 }
 
+/*
+ * Copy at most count profiles starting from the cursor-th one in insertion
+ * order, *next is set to the cursor of the following call, or 0 if we have
+ * reached the end of the list.
+ */
+u32 ksu_get_app_profiles(struct app_profile *profiles, u32 cursor, u32 count,
+			 u32 *next)
+{
+	struct perm_data *p = NULL;
+	u32 index = 0;
+	u32 n = 0;
+
+	*next = 0;
+	rcu_read_lock();
+	list_for_each_entry_rcu (p, &allow_list, list) {
+		if (index++ < cursor)
+			continue;
+		if (n == count) {
+			*next = index - 1;
+			break;
+		}
+		copy_app_profile(&profiles[n++], p);
+	}
+	rcu_read_unlock();
+
+	return n;
+}
+
 static inline bool forbid_system_uid(uid_t uid) {
 	#define SHELL_UID 2000
 	#define SYSTEM_UID 1000
@@ -174,10 +791,93 @@ static bool profile_valid(struct app_profile *profile)
 	return true;
 }
 
+/*
+ * Publish p in the allowlist, replacing the profile with the same uid and key.
+ * Must be called with allowlist_mutex held. p is owned by the allowlist if it
+ * returns true, otherwise nothing was changed and the caller frees p.
+ */
+static bool insert_perm_data_locked(struct perm_data *p, bool verbose)
+{
+	// only the head of the profile is there, see PERM_DATA_PROFILE_SIZE
+	struct app_profile *profile = &p->profile;
+	struct perm_data *old = NULL;
+	struct root_profile_holder *holder = NULL;
+
+	// allocate it before p is visible, so a failure leaves nothing half set
+	if (profile->current_uid > BITMAP_UID_MAX && profile->allow_su &&
+	    !get_user_bitmap_locked(profile->current_uid, true))
+		return false;
+
+	// both uid and package must match, otherwise it will break multiple package with different user id
+	old = find_perm_data_locked(profile->current_uid, profile->key);
+	if (old) {
+		// found it, just override it all!
+		list_replace_rcu(&old->list, &p->list);
+		hlist_replace_rcu(&old->uid_node, &p->uid_node);
+		hlist_replace_rcu(&old->key_node, &p->key_node);
+		free_perm_data_locked(old);
+	} else {
+		// don't flood the log while loading the allowlist
+		if (verbose && profile->allow_su) {
+			pr_info("set root profile, key: %s, uid: %d, template: %s\n",
+				profile->key, profile->current_uid,
+				p->root->name);
+		} else if (verbose) {
+			pr_info("set app profile, key: %s, uid: %d, umount modules: %d\n",
+				profile->key, profile->current_uid,
+				profile->nrp_config.profile.umount_modules);
+		}
+		list_add_tail_rcu(&p->list, &allow_list);
+		hlist_add_tail_rcu(&p->uid_node, uid_bucket(profile->current_uid));
+		hash_add_rcu(allow_list_key_table, &p->key_node,
+			     profile_key_hash(profile->current_uid, profile->key));
+		allow_list_count++;
+	}
+
+	if (profile->current_uid <= BITMAP_UID_MAX) {
+		if (profile->allow_su)
+			ksu_allow_list_bitmap[profile->current_uid / BITS_PER_BYTE] |= 1 << (profile->current_uid % BITS_PER_BYTE);
+		else
+			ksu_allow_list_bitmap[profile->current_uid / BITS_PER_BYTE] &= ~(1 << (profile->current_uid % BITS_PER_BYTE));
+	} else {
+		set_user_bitmap_locked(profile->current_uid, profile->allow_su);
+	}
+	update_uid_verdict_locked(profile->current_uid);
+	bump_generation_locked();
+
+	// check if the default profiles is changed, cache it to a single struct to accelerate access.
+	if (unlikely(!strcmp(profile->key, "$"))) {
+		// set default non root profile
+		WRITE_ONCE(default_non_root_profile.umount_modules,
+			   profile->nrp_config.profile.umount_modules);
+		rcu_assign_pointer(default_non_root_perm, p);
+	}
+
+	// only a profile allowed to su has a root profile, see
+	// new_perm_data_locked, the default root profile is kept otherwise
+	if (unlikely(!strcmp(profile->key, "#")) && p->root) {
+		// set default root profile
+		holder = new_root_profile_holder(
+			&interned_holder_locked(p->root)->profile);
+		if (holder) {
+			struct root_profile_holder *old_holder =
+				rcu_dereference_protected(
+					default_root_profile,
+					lockdep_is_held(&allowlist_mutex));
+			rcu_assign_pointer(default_root_profile, holder);
+			if (old_holder)
+				ksu_put_root_profile_holder(old_holder);
+		} else {
+			pr_err("default root profile alloc failed\n");
+		}
+	}
+
+	return true;
+}
+
 bool ksu_set_app_profile(struct app_profile *profile, bool persist)
 {
 	struct perm_data *p = NULL;
-	struct list_head *pos = NULL;
 	bool result = false;
 
 	if (!profile_valid(profile)) {
@@ -185,76 +885,65 @@ bool ksu_set_app_profile(struct app_profile *profile, bool persist)
 		return false;
 	}
 
-	list_for_each (pos, &allow_list) {
-		p = list_entry(pos, struct perm_data, list);
-		// both uid and package must match, otherwise it will break multiple package with different user id
-		if (profile->current_uid == p->profile.current_uid &&
-		    !strcmp(profile->key, p->profile.key)) {
-			// found it, just override it all!
-			memcpy(&p->profile, profile, sizeof(*profile));
-			result = true;
-			goto out;
-		}
-	}
-
-	// not found, alloc a new node!
-	p = (struct perm_data *)kmalloc(sizeof(struct perm_data), GFP_KERNEL);
+	mutex_lock(&allowlist_mutex);
+	// readers may be walking the old node, so we always publish a new one
+	p = new_perm_data_locked(profile);
 	if (!p) {
+		mutex_unlock(&allowlist_mutex);
 		pr_err("ksu_set_app_profile alloc failed\n");
 		return false;
 	}
+	result = insert_perm_data_locked(p, true);
+	if (!result)
+		free_perm_data_locked(p);
+	else if (persist)
+		queue_allowlist_change_locked(KSU_RECORD_SET_PROFILE, profile);
+	mutex_unlock(&allowlist_mutex);
 
-	memcpy(&p->profile, profile, sizeof(*profile));
-	if (profile->allow_su) {
-		pr_info("set root profile, key: %s, uid: %d, gid: %d, context: %s\n",
-			profile->key, profile->current_uid,
-			profile->rp_config.profile.gid,
-			profile->rp_config.profile.selinux_domain);
-	} else {
-		pr_info("set app profile, key: %s, uid: %d, umount modules: %d\n",
-			profile->key, profile->current_uid,
-			profile->nrp_config.profile.umount_modules);
-	}
-	list_add_tail(&p->list, &allow_list);
+	if (result && persist)
+		persistent_allow_list();
 
-out:
-	if (profile->current_uid <= BITMAP_UID_MAX) {
-		if (profile->allow_su)
-			allow_list_bitmap[profile->current_uid / BITS_PER_BYTE] |= 1 << (profile->current_uid % BITS_PER_BYTE);
-		else
-			allow_list_bitmap[profile->current_uid / BITS_PER_BYTE] &= ~(1 << (profile->current_uid % BITS_PER_BYTE));
-	} else {
-		if (profile->allow_su) {
-			/*
-			 * 1024 apps with uid higher than BITMAP_UID_MAX
-			 * registered to request superuser?
-			 */
-			if (allow_list_pointer >= ARRAY_SIZE(allow_list_arr)) {
-				pr_err("too many apps registered\n");
-				WARN_ON(1);
-				return false;
-			}
-			allow_list_arr[allow_list_pointer++] = profile->current_uid;
-		} else {
-			remove_uid_from_arr(profile->current_uid);
-		}
+	return result;
+}
+
+/*
+ * Update the profile of a template for every app using it in O(1), the file is
+ * rewritten in the background since the journal holds the resolved profiles.
+ */
+bool ksu_set_root_profile_template(const char *name,
+				   const struct root_profile *profile)
+{
+	struct interned_root_profile *root = NULL;
+	struct root_profile canonical;
+	bool result = true;
+
+	if (!name[0])
+		return false;
+
+	canonical_root_profile(&canonical, profile);
+
+	mutex_lock(&allowlist_mutex);
+	root = find_interned_template_locked(name);
+	if (!root) {
+		// no app uses it yet
+		goto unlock;
 	}
-	result = true;
 
-	// check if the default profiles is changed, cache it to a single struct to accelerate access.
-	if (unlikely(!strcmp(profile->key, "$"))) {
-		// set default non root profile
-		memcpy(&default_non_root_profile, &profile->nrp_config.profile,
-		       sizeof(default_non_root_profile));
+	if (!memcmp(&interned_holder_locked(root)->profile, &canonical,
+		    sizeof(canonical))) {
+		goto unlock;
 	}
 
-	if (unlikely(!strcmp(profile->key, "#"))) {
-		// set default root profile
-		memcpy(&default_root_profile, &profile->rp_config.profile,
-		       sizeof(default_root_profile));
+	result = set_interned_profile_locked(root, &canonical);
+	if (result) {
+		pr_info("update template: %s, apps: %d\n", name, root->refs);
+		compact_pending = true;
+		bump_generation_locked();
 	}
+unlock:
+	mutex_unlock(&allowlist_mutex);
 
-	if (persist)
+	if (root && result)
 		persistent_allow_list();
 
 	return result;
@@ -262,8 +951,6 @@ out:
 
 bool __ksu_is_allow_uid(uid_t uid)
 {
-	int i;
-
 	if (unlikely(uid == 0)) {
 		// already root, but only allow our domain.
 		return is_ksu_domain();
@@ -275,122 +962,599 @@ bool __ksu_is_allow_uid(uid_t uid)
 	}
 
 	if (likely(uid <= BITMAP_UID_MAX)) {
-		return !!(allow_list_bitmap[uid / BITS_PER_BYTE] & (1 << (uid % BITS_PER_BYTE)));
-	} else {
-		for (i = 0; i < allow_list_pointer; i++) {
-			if (allow_list_arr[i] == uid)
-				return true;
-		}
+		return !!(ksu_allow_list_bitmap[uid / BITS_PER_BYTE] & (1 << (uid % BITS_PER_BYTE)));
 	}
 
-	return false;
+	return is_uid_in_user_bitmap(uid);
 }
 
 bool ksu_uid_should_umount(uid_t uid)
 {
-	struct app_profile profile = { .current_uid = uid };
-	bool found = ksu_get_app_profile(&profile);
-	if (!found) {
-		// no app profile found, it must be non root app
-		return default_non_root_profile.umount_modules;
+	struct perm_data *p = NULL;
+	u8 verdict = KSU_VERDICT_DEFAULT;
+
+	if (likely(uid <= BITMAP_UID_MAX)) {
+		verdict = get_uid_verdict(uid);
+	} else if (is_uid_in_user_bitmap(uid)) {
+		// any profile of the uid allowed to su, the same as
+		// update_uid_verdict_locked
+		verdict = KSU_VERDICT_ALLOW_SU;
+	} else {
+		rcu_read_lock();
+		hlist_for_each_entry_rcu (p, uid_bucket(uid), uid_node) {
+			if (uid == p->profile.current_uid) {
+				verdict = profile_verdict(&p->profile);
+				break;
+			}
+		}
+		rcu_read_unlock();
 	}
-	if (profile.allow_su) {
-		// if found and it is granted to su, we shouldn't umount for it
+
+	switch (verdict) {
+	case KSU_VERDICT_ALLOW_SU:
+	case KSU_VERDICT_NO_UMOUNT:
 		return false;
-	} else {
-		// found an app profile
-		if (profile.nrp_config.use_default) {
-			return default_non_root_profile.umount_modules;
-		} else {
-			return profile.nrp_config.profile.umount_modules;
+	case KSU_VERDICT_UMOUNT:
+		return true;
+	default:
+		// no app profile found or it uses the default one
+		return READ_ONCE(default_non_root_profile.umount_modules);
+	}
+}
+
+/*
+ * Get the umount paths of the non root profile of the uid, falling back to the
+ * default one. Called from the umount path only, after ksu_uid_should_umount.
+ */
+void ksu_get_umount_paths(uid_t uid, struct non_root_profile *profile)
+{
+	const struct non_root_profile *src = NULL;
+	struct perm_data *p = NULL;
+
+	rcu_read_lock();
+	hlist_for_each_entry_rcu (p, uid_bucket(uid), uid_node) {
+		if (uid == p->profile.current_uid) {
+			if (!p->profile.allow_su &&
+			    !p->profile.nrp_config.use_default)
+				src = &p->profile.nrp_config.profile;
+			break;
 		}
 	}
+	if (!src) {
+		p = rcu_dereference(default_non_root_perm);
+		if (p && !p->profile.allow_su)
+			src = &p->profile.nrp_config.profile;
+	}
+
+	if (src) {
+		memcpy(profile, src, sizeof(*profile));
+	} else {
+		memset(profile, 0, sizeof(*profile));
+		profile->umount_modules = true;
+	}
+	rcu_read_unlock();
 }
 
-struct root_profile *ksu_get_root_profile(uid_t uid)
+/*
+ * Get a reference to the root profile of the uid, NULL if there is none.
+ * It must be released with ksu_put_root_profile_holder.
+ */
+struct root_profile_holder *ksu_get_root_profile_holder(uid_t uid)
 {
 	struct perm_data *p = NULL;
-	struct list_head *pos = NULL;
+	struct root_profile_holder *holder = NULL;
 
-	list_for_each (pos, &allow_list) {
-		p = list_entry(pos, struct perm_data, list);
+	rcu_read_lock();
+retry:
+	holder = NULL;
+	hlist_for_each_entry_rcu (p, uid_bucket(uid), uid_node) {
 		if (uid == p->profile.current_uid && p->profile.allow_su) {
 			if (!p->profile.rp_config.use_default) {
-				return &p->profile.rp_config.profile;
+				holder = rcu_dereference(p->root->holder);
+				break;
 			}
 		}
 	}
 
-	// use default profile
-	return &default_root_profile;
+	if (!holder) {
+		// use default profile
+		holder = rcu_dereference(default_root_profile);
+	}
+
+	// the last reference is dropped only after it is replaced, look again
+	if (holder && !kref_get_unless_zero(&holder->ref))
+		goto retry;
+	rcu_read_unlock();
+
+	return holder;
 }
 
-bool ksu_get_allow_list(int *array, int *length, bool allow)
+/*
+ * Copy at most capacity uids which are (or not, see allow) allowed to su,
+ * starting from the cursor-th profile. *next is set to the cursor of the
+ * following call, or 0 if we have reached the end of the list.
+ */
+u32 ksu_get_allow_list(int *array, u32 capacity, u32 cursor, u32 *next,
+		       bool allow)
 {
 	struct perm_data *p = NULL;
-	struct list_head *pos = NULL;
-	int i = 0;
-	list_for_each (pos, &allow_list) {
-		p = list_entry(pos, struct perm_data, list);
-		// pr_info("get_allow_list uid: %d allow: %d\n", p->uid, p->allow);
-		if (p->profile.allow_su == allow) {
-			array[i++] = p->profile.current_uid;
+	u32 index = 0;
+	u32 n = 0;
+
+	*next = 0;
+	rcu_read_lock();
+	list_for_each_entry_rcu (p, &allow_list, list) {
+		if (index++ < cursor || p->profile.allow_su != allow)
+			continue;
+		if (n == capacity) {
+			*next = index - 1;
+			break;
 		}
+		array[n++] = p->profile.current_uid;
 	}
-	*length = i;
+	rcu_read_unlock();
 
-	return true;
+	return n;
+}
+
+u32 ksu_get_allow_list_generation(void)
+{
+	return READ_ONCE(allow_list_generation);
+}
+
+/*
+ * A notify fd becomes readable when the allowlist changed since it was last
+ * read (or opened), reading it returns the current generation as a u32.
+ */
+struct allow_list_notifier {
+	u32 seen;
+};
+
+static bool allow_list_changed(struct allow_list_notifier *notifier)
+{
+	return READ_ONCE(allow_list_generation) != READ_ONCE(notifier->seen);
+}
+
+static ssize_t allow_list_notify_read(struct file *file, char __user *buf,
+				      size_t count, loff_t *ppos)
+{
+	struct allow_list_notifier *notifier = file->private_data;
+	u32 generation;
+	int ret;
+
+	if (count < sizeof(generation))
+		return -EINVAL;
+
+	if (!allow_list_changed(notifier)) {
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		ret = wait_event_interruptible(allow_list_waitq,
+					       allow_list_changed(notifier));
+		if (ret)
+			return ret;
+	}
+
+	generation = READ_ONCE(allow_list_generation);
+	WRITE_ONCE(notifier->seen, generation);
+	if (copy_to_user(buf, &generation, sizeof(generation)))
+		return -EFAULT;
+
+	return sizeof(generation);
+}
+
+static __poll_t allow_list_notify_poll(struct file *file, poll_table *wait)
+{
+	struct allow_list_notifier *notifier = file->private_data;
+
+	poll_wait(file, &allow_list_waitq, wait);
+	if (allow_list_changed(notifier))
+		return EPOLLIN | EPOLLRDNORM;
+
+	return 0;
+}
+
+static int allow_list_notify_release(struct inode *inode, struct file *file)
+{
+	kfree(file->private_data);
+	return 0;
+}
+
+static const struct file_operations allow_list_notify_fops = {
+	.owner = THIS_MODULE,
+	.read = allow_list_notify_read,
+	.poll = allow_list_notify_poll,
+	.release = allow_list_notify_release,
+	.llseek = noop_llseek,
+};
+
+int ksu_allow_list_notify_fd(void)
+{
+	struct allow_list_notifier *notifier = NULL;
+	int fd;
+
+	notifier = kmalloc(sizeof(*notifier), GFP_KERNEL);
+	if (!notifier)
+		return -ENOMEM;
+	notifier->seen = READ_ONCE(allow_list_generation);
+
+	fd = anon_inode_getfd("[ksu_allowlist]", &allow_list_notify_fops,
+			      notifier, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		kfree(notifier);
+
+	return fd;
+}
+
+// the payload must already be at buf + sizeof(struct allowlist_record)
+static size_t seal_record(char *buf, u32 *crc, u32 type, u32 size)
+{
+	struct allowlist_record *record = (struct allowlist_record *)buf;
+
+	record->type = type;
+	record->size = size;
+	*crc = crc32_le(*crc, (const u8 *)record,
+			offsetof(struct allowlist_record, crc));
+	*crc = crc32_le(*crc, buf + sizeof(*record), size);
+	record->crc = *crc;
+
+	return sizeof(*record) + size;
+}
+
+static size_t put_record(char *buf, u32 *crc, u32 type, const void *payload,
+			 u32 size)
+{
+	memcpy(buf + sizeof(struct allowlist_record), payload, size);
+	return seal_record(buf, crc, type, size);
+}
+
+static size_t put_profile_record(char *buf, u32 *crc,
+				 const struct app_profile *profile)
+{
+	ssize_t size = ksu_profile_tlv_encode(
+		profile, buf + sizeof(struct allowlist_record),
+		KSU_PROFILE_TLV_MAX);
+
+	if (unlikely(size < 0)) {
+		// should never happen, but the raw struct is always loadable
+		return put_record(buf, crc, KSU_RECORD_SET_PROFILE, profile,
+				  sizeof(*profile));
+	}
+
+	return seal_record(buf, crc, KSU_RECORD_SET_PROFILE_TLV, size);
 }
 
-void do_save_allow_list(struct work_struct *work)
+static size_t put_change(char *buf, u32 *crc, struct allowlist_change *change)
+{
+	struct allowlist_delete_record del;
+
+	if (change->type == KSU_RECORD_DELETE_PROFILE) {
+		memset(&del, 0, sizeof(del));
+		del.current_uid = change->profile.current_uid;
+		strscpy(del.key, change->profile.key, sizeof(del.key));
+		return put_record(buf, crc, change->type, &del, sizeof(del));
+	}
+
+	return put_profile_record(buf, crc, &change->profile);
+}
+
+// the payload of any record fits in KSU_PROFILE_TLV_MAX, see ksu_allowlist_init
+#define MAX_RECORD_SIZE                                                        \
+	(sizeof(struct allowlist_record) + KSU_PROFILE_TLV_MAX)
+
+// snapshot the live profiles into a fresh journal, must hold allowlist_mutex
+static char *build_compacted_locked(size_t *len, u32 *crc, u32 *records)
 {
-	u32 magic = FILE_MAGIC;
-	u32 version = FILE_FORMAT_VERSION;
 	struct perm_data *p = NULL;
-	struct list_head *pos = NULL;
+	struct app_profile *profile = NULL;
+	u32 header[2] = { FILE_MAGIC, FILE_FORMAT_VERSION };
+	size_t off = 0;
+	char *buf = NULL;
+
+	profile = kmalloc(sizeof(*profile), GFP_KERNEL);
+	if (!profile)
+		return NULL;
+
+	buf = vmalloc(sizeof(header) + allow_list_count * MAX_RECORD_SIZE);
+	if (!buf) {
+		kfree(profile);
+		return NULL;
+	}
+
+	memcpy(buf, header, sizeof(header));
+	off = sizeof(header);
+	*crc = 0;
+	*records = 0;
+	list_for_each_entry (p, &allow_list, list) {
+		copy_app_profile(profile, p);
+		off += put_profile_record(buf + off, crc, profile);
+		(*records)++;
+	}
+	*len = off;
+	kfree(profile);
+
+	return buf;
+}
+
+static char *build_appended(struct list_head *changes, u32 count, size_t *len,
+			    u32 *crc)
+{
+	struct allowlist_change *change = NULL;
+	size_t off = 0;
+	char *buf = vmalloc(count * MAX_RECORD_SIZE);
+
+	if (!buf)
+		return NULL;
+
+	list_for_each_entry (change, changes, list) {
+		off += put_change(buf + off, crc, change);
+	}
+	*len = off;
+
+	return buf;
+}
+
+static void do_save_allow_list(struct work_struct *work)
+{
+	LIST_HEAD(changes);
+	struct allowlist_change *change = NULL;
+	struct allowlist_change *n = NULL;
+	struct file *fp = NULL;
+	char *buf = NULL;
+	size_t len = 0;
+	u32 count = 0;
+	u32 crc = journal_crc;
+	u32 records = 0;
+	bool compact = false;
 	loff_t off = 0;
 
-	struct file *fp =
-		ksu_filp_open_compat(KERNEL_SU_ALLOWLIST, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	mutex_lock(&allowlist_mutex);
+	list_splice_init(&pending_changes, &changes);
+	list_for_each_entry (change, &changes, list) {
+		count++;
+	}
+
+	compact = compact_pending || journal_size == 0 ||
+		  journal_records + count >
+			  2 * allow_list_count + KSU_JOURNAL_COMPACT_SLACK;
+	compact_pending = false;
+	if (compact) {
+		// the snapshot already contains every pending change
+		buf = build_compacted_locked(&len, &crc, &records);
+	}
+	mutex_unlock(&allowlist_mutex);
+
+	if (!compact) {
+		if (!count)
+			goto out;
+		buf = build_appended(&changes, count, &len, &crc);
+		records = journal_records + count;
+	}
+
+	if (!buf) {
+		pr_err("save_allow_list alloc buffer failed\n");
+		goto fail;
+	}
+
+	if (compact) {
+		fp = ksu_filp_open_compat(KERNEL_SU_ALLOWLIST,
+					  O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	} else {
+		fp = ksu_filp_open_compat(KERNEL_SU_ALLOWLIST,
+					  O_WRONLY | O_CREAT, 0644);
+		off = journal_size;
+	}
 	if (IS_ERR(fp)) {
-		pr_err("save_allow_list create file failed: %ld\n", PTR_ERR(fp));
+		pr_err("save_allow_list open file failed: %ld\n", PTR_ERR(fp));
+		goto fail;
+	}
+
+	if (ksu_kernel_write_compat(fp, buf, len, &off) != len) {
+		pr_err("save_allow_list write failed.\n");
+		filp_close(fp, 0);
+		goto fail;
+	}
+
+	if (vfs_fsync(fp, 0)) {
+		pr_err("save_allow_list fsync failed.\n");
+	}
+	filp_close(fp, 0);
+
+	pr_info("save allow list, %s %zu bytes, records: %d\n",
+		compact ? "compact" : "append", len, records);
+
+	journal_size = off;
+	journal_crc = crc;
+	journal_records = records;
+	goto out;
+
+fail:
+	// the journal state is unknown now, rewrite it next time
+	journal_size = 0;
+	mutex_lock(&allowlist_mutex);
+	compact_pending = true;
+	mutex_unlock(&allowlist_mutex);
+out:
+	if (buf)
+		vfree(buf);
+	list_for_each_entry_safe (change, n, &changes, list) {
+		list_del(&change->list);
+		kfree(change);
+	}
+}
+
+/*
+ * The allowlist is restored at boot, so it is read with a single read and the
+ * index is built in one pass under a single allowlist_mutex hold. Records of a
+ * v4 journal passed the crc check, but they still go through profile_valid
+ * like the legacy ones, the file may be written by an older or buggy version.
+ */
+#define KSU_ALLOWLIST_MAX_SIZE (64 * 1024 * 1024)
+
+static void load_legacy_allow_list(const char *buf, size_t len)
+{
+	struct app_profile *profile = NULL;
+	size_t off = 0;
+	u32 loaded = 0;
+
+	profile = kmalloc(sizeof(*profile), GFP_KERNEL);
+	if (!profile) {
+		pr_err("load_allow_list alloc failed\n");
 		return;
 	}
 
-	// store magic and version
-	if (ksu_kernel_write_compat(fp, &magic, sizeof(magic), &off) !=
-	    sizeof(magic)) {
-		pr_err("save_allow_list write magic failed.\n");
-		goto exit;
+	mutex_lock(&allowlist_mutex);
+	for (off = 0; off + sizeof(*profile) <= len; off += sizeof(*profile)) {
+		struct perm_data *p = NULL;
+
+		memcpy(profile, buf + off, sizeof(*profile));
+		if (!profile_valid(profile)) {
+			continue;
+		}
+		p = new_perm_data_locked(profile);
+		if (!p) {
+			pr_err("load_allow_list alloc failed\n");
+			break;
+		}
+		if (!insert_perm_data_locked(p, false)) {
+			free_perm_data_locked(p);
+			continue;
+		}
+		loaded++;
 	}
+	mutex_unlock(&allowlist_mutex);
+	kfree(profile);
 
-	if (ksu_kernel_write_compat(fp, &version, sizeof(version), &off) !=
-	    sizeof(version)) {
-		pr_err("save_allow_list write version failed.\n");
-		goto exit;
+	pr_info("legacy allowlist loaded, profiles: %d\n", loaded);
+
+	// convert it to the journal format
+	journal_size = 0;
+	persistent_allow_list();
+}
+
+// returns the size of the valid prefix of the journal
+static size_t check_journal(const char *buf, size_t len, u32 *crc,
+			    u32 *records)
+{
+	struct allowlist_record record;
+	size_t off = 0;
+
+	*crc = 0;
+	*records = 0;
+	while (off + sizeof(record) <= len) {
+		u32 expected;
+
+		memcpy(&record, buf + off, sizeof(record));
+		if (record.size > KSU_PROFILE_TLV_MAX ||
+		    record.size > len - off - sizeof(record)) {
+			pr_err("allowlist journal truncated at record %d\n",
+			       *records);
+			break;
+		}
+
+		expected = crc32_le(*crc, (const u8 *)&record,
+				    offsetof(struct allowlist_record, crc));
+		expected = crc32_le(expected, buf + off + sizeof(record),
+				    record.size);
+		if (expected != record.crc) {
+			pr_err("allowlist journal crc mismatch at record %d\n",
+			       *records);
+			break;
+		}
+
+		*crc = expected;
+		(*records)++;
+		off += sizeof(record) + record.size;
 	}
 
-	list_for_each (pos, &allow_list) {
-		p = list_entry(pos, struct perm_data, list);
-		pr_info("save allow list, name: %s uid :%d, allow: %d\n",
-			p->profile.key, p->profile.current_uid,
-			p->profile.allow_su);
+	return off;
+}
 
-		ksu_kernel_write_compat(fp, &p->profile, sizeof(p->profile),
-					&off);
+static void load_journal(const char *buf, size_t len)
+{
+	struct allowlist_record record;
+	struct allowlist_delete_record del;
+	struct app_profile *profile = NULL;
+	struct perm_data *p = NULL;
+	size_t valid = 0;
+	size_t off = 0;
+	u32 crc = 0;
+	u32 records = 0;
+
+	valid = check_journal(buf, len, &crc, &records);
+
+	profile = kmalloc(sizeof(*profile), GFP_KERNEL);
+	if (!profile) {
+		pr_err("load_allow_list alloc failed\n");
+		return;
 	}
 
-exit:
-	filp_close(fp, 0);
+	mutex_lock(&allowlist_mutex);
+	while (off < valid) {
+		const char *payload = buf + off + sizeof(record);
+
+		memcpy(&record, buf + off, sizeof(record));
+		off += sizeof(record) + record.size;
+
+		switch (record.type) {
+		case KSU_RECORD_SET_PROFILE:
+		case KSU_RECORD_SET_PROFILE_TLV:
+			if (record.type == KSU_RECORD_SET_PROFILE) {
+				if (record.size != sizeof(*profile))
+					break;
+				memcpy(profile, payload, sizeof(*profile));
+			} else if (ksu_profile_tlv_decode(payload, record.size,
+							  profile)) {
+				break;
+			}
+			if (!profile_valid(profile))
+				break;
+			p = new_perm_data_locked(profile);
+			if (!p) {
+				pr_err("load_allow_list alloc failed\n");
+				// don't let a partial list be compacted over the file
+				valid = len;
+				goto unlock;
+			}
+			if (!insert_perm_data_locked(p, false))
+				free_perm_data_locked(p);
+			break;
+		case KSU_RECORD_DELETE_PROFILE:
+			if (record.size != sizeof(del))
+				break;
+			memcpy(&del, payload, sizeof(del));
+			del.key[sizeof(del.key) - 1] = '\0';
+			p = find_perm_data_locked(del.current_uid, del.key);
+			if (p)
+				remove_perm_data_locked(p);
+			break;
+		default:
+			pr_warn("unknown allowlist record: %d\n", record.type);
+			break;
+		}
+	}
+unlock:
+	mutex_unlock(&allowlist_mutex);
+	kfree(profile);
+
+	journal_size = sizeof(u32) * 2 + len;
+	journal_crc = crc;
+	journal_records = records;
+
+	if (valid != len) {
+		// keep what we have replayed and rewrite a clean journal
+		journal_size = 0;
+		persistent_allow_list();
+	}
 }
 
-void do_load_allow_list(struct work_struct *work)
+static void do_load_allow_list(struct work_struct *work)
 {
 	loff_t off = 0;
-	ssize_t ret = 0;
+	loff_t size = 0;
 	struct file *fp = NULL;
-	u32 magic;
-	u32 version;
+	char *buf = NULL;
+	u32 header[2];
+	ktime_t start;
 
 #ifdef CONFIG_KSU_DEBUG
 	// always allow adb shell by default
@@ -404,41 +1568,58 @@ void do_load_allow_list(struct work_struct *work)
 		return;
 	}
 
-	// verify magic
-	if (ksu_kernel_read_compat(fp, &magic, sizeof(magic), &off) !=
-		    sizeof(magic) ||
-	    magic != FILE_MAGIC) {
-		pr_err("allowlist file invalid: %d!\n", magic);
-		goto exit;
+	size = i_size_read(file_inode(fp));
+	if (size < sizeof(header) || size > KSU_ALLOWLIST_MAX_SIZE) {
+		pr_err("allowlist file invalid size: %lld\n", size);
+		filp_close(fp, 0);
+		return;
 	}
 
-	if (ksu_kernel_read_compat(fp, &version, sizeof(version), &off) !=
-	    sizeof(version)) {
-		pr_err("allowlist read version: %d failed\n", version);
-		goto exit;
+	buf = vmalloc(size);
+	if (!buf) {
+		pr_err("load_allow_list alloc %lld bytes failed\n", size);
+		filp_close(fp, 0);
+		return;
 	}
 
-	pr_info("allowlist version: %d\n", version);
+	while (off < size) {
+		ssize_t ret = ksu_kernel_read_compat(fp, buf + off, size - off,
+						     &off);
+		if (ret <= 0)
+			break;
+	}
+	filp_close(fp, 0);
 
-	while (true) {
-		struct app_profile profile;
+	if (off != size) {
+		pr_err("load_allow_list read failed: %lld/%lld\n", off, size);
+		goto exit;
+	}
 
-		ret = ksu_kernel_read_compat(fp, &profile, sizeof(profile),
-					     &off);
+	// verify magic
+	memcpy(header, buf, sizeof(header));
+	if (header[0] != FILE_MAGIC) {
+		pr_err("allowlist file invalid: %d!\n", header[0]);
+		goto exit;
+	}
 
-		if (ret <= 0) {
-			pr_info("load_allow_list read err: %zd\n", ret);
-			break;
-		}
+	pr_info("allowlist version: %d\n", header[1]);
 
-		pr_info("load_allow_uid, name: %s, uid: %d, allow: %d\n",
-			profile.key, profile.current_uid, profile.allow_su);
-		ksu_set_app_profile(&profile, false);
+	start = ktime_get();
+	if (header[1] <= FILE_FORMAT_VERSION_LEGACY) {
+		load_legacy_allow_list(buf + sizeof(header),
+				       size - sizeof(header));
+	} else {
+		load_journal(buf + sizeof(header), size - sizeof(header));
 	}
+	pr_info("allowlist loaded, profiles: %d, took %lld us\n",
+		allow_list_count, ktime_us_delta(ktime_get(), start));
 
-exit:
+#ifdef CONFIG_KSU_DEBUG
 	ksu_show_allow_list();
-	filp_close(fp, 0);
+#endif
+
+exit:
+	vfree(buf);
 }
 
 void ksu_prune_allowlist(bool (*is_uid_valid)(uid_t, char *, void *), void *data)
@@ -447,7 +1628,6 @@ void ksu_prune_allowlist(bool (*is_uid_valid)(uid_t, char *, void *), void *data
 	struct perm_data *n = NULL;
 
 	bool modified = false;
-	// TODO: use RCU!
 	mutex_lock(&allowlist_mutex);
 	list_for_each_entry_safe (np, n, &allow_list, list) {
 		uid_t uid = np->profile.current_uid;
@@ -457,13 +1637,9 @@ void ksu_prune_allowlist(bool (*is_uid_valid)(uid_t, char *, void *), void *data
 		if (!is_preserved_uid && !is_uid_valid(uid, package, data)) {
 			modified = true;
 			pr_info("prune uid: %d, package: %s\n", uid, package);
-			list_del(&np->list);
-			if (likely(uid <= BITMAP_UID_MAX)) {
-				allow_list_bitmap[uid / BITS_PER_BYTE] &= ~(1 << (uid % BITS_PER_BYTE));
-			}
-			remove_uid_from_arr(uid);
-			smp_mb();
-			kfree(np);
+			queue_allowlist_change_locked(KSU_RECORD_DELETE_PROFILE,
+						      &np->profile);
+			remove_perm_data_locked(np);
 		}
 	}
 	mutex_unlock(&allowlist_mutex);
@@ -473,10 +1649,12 @@ void ksu_prune_allowlist(bool (*is_uid_valid)(uid_t, char *, void *), void *data
 	}
 }
 
-// make sure allow list works cross boot
+// make sure allow list works cross boot, changes made in a short time are
+// coalesced into a single write
 bool persistent_allow_list(void)
 {
-	return ksu_queue_work(&ksu_save_work);
+	return ksu_queue_delayed_work(&ksu_save_work,
+				      msecs_to_jiffies(KSU_SAVE_DELAY_MS));
 }
 
 bool ksu_load_allow_list(void)
@@ -486,17 +1664,22 @@ bool ksu_load_allow_list(void)
 
 void ksu_allowlist_init(void)
 {
-	int i;
-
-	BUILD_BUG_ON(sizeof(allow_list_bitmap) != PAGE_SIZE);
-	BUILD_BUG_ON(sizeof(allow_list_arr) != PAGE_SIZE);
-
-	for (i = 0; i < ARRAY_SIZE(allow_list_arr); i++)
-		allow_list_arr[i] = -1;
+	BUILD_BUG_ON(sizeof(ksu_allow_list_bitmap) * BITS_PER_BYTE - 1 !=
+		     KSU_BITMAP_UID_MAX);
+	BUILD_BUG_ON(sizeof(allow_list_verdict) * KSU_VERDICTS_PER_BYTE !=
+		     BITMAP_UID_MAX + 1);
+	BUILD_BUG_ON(sizeof(struct app_profile) > KSU_PROFILE_TLV_MAX);
+	// the umount paths must not grow struct app_profile
+	BUILD_BUG_ON(sizeof(((struct app_profile *)0)->nrp_config) >
+		     sizeof(((struct app_profile *)0)->rp_config));
+	BUILD_BUG_ON(sizeof(struct allowlist_delete_record) >
+		     KSU_PROFILE_TLV_MAX);
 
 	INIT_LIST_HEAD(&allow_list);
+	hash_init(allow_list_uid_table);
+	hash_init(allow_list_key_table);
 
-	INIT_WORK(&ksu_save_work, do_save_allow_list);
+	INIT_DELAYED_WORK(&ksu_save_work, do_save_allow_list);
 	INIT_WORK(&ksu_load_work, do_load_allow_list);
 
 	init_default_profiles();
@@ -506,14 +1689,35 @@ void ksu_allowlist_exit(void)
 {
 	struct perm_data *np = NULL;
 	struct perm_data *n = NULL;
+	struct root_profile_holder *holder = NULL;
+	struct user_allow_bitmap *bitmap = NULL;
+	struct user_allow_bitmap *next = NULL;
 
+	// flush the pending changes now
+	cancel_delayed_work_sync(&ksu_save_work);
 	do_save_allow_list(NULL);
 
 	// free allowlist
 	mutex_lock(&allowlist_mutex);
 	list_for_each_entry_safe (np, n, &allow_list, list) {
-		list_del(&np->list);
-		kfree(np);
+		list_del_rcu(&np->list);
+		hash_del_rcu(&np->uid_node);
+		hash_del_rcu(&np->key_node);
+		free_perm_data_locked(np);
+	}
+	allow_list_count = 0;
+	holder = rcu_dereference_protected(default_root_profile,
+					   lockdep_is_held(&allowlist_mutex));
+	RCU_INIT_POINTER(default_root_profile, NULL);
+	if (holder)
+		ksu_put_root_profile_holder(holder);
+	list_for_each_entry_safe (bitmap, next, &allow_list_user_bitmaps, list) {
+		radix_tree_delete(&allow_list_users, bitmap->user_id);
+		list_del(&bitmap->list);
+		kfree_rcu(bitmap, rcu);
 	}
 	mutex_unlock(&allowlist_mutex);
+
+	// the holders are freed by our own rcu callback
+	rcu_barrier();
 }
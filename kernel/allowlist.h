@@ -1,9 +1,29 @@
 #ifndef __KSU_H_ALLOWLIST
 #define __KSU_H_ALLOWLIST
 
+#include "asm/page.h"
+#include "linux/bitops.h"
+#include "linux/compiler.h"
+#include "linux/cred.h"
+#include "linux/kref.h"
+#include "linux/rcupdate.h"
 #include "linux/types.h"
 #include "ksu.h"
 
+/*
+ * A root profile with the parts of the credential escape_to_root needs
+ * prepared in advance. It is immutable and replaced when the profile changes.
+ */
+struct root_profile_holder {
+	struct kref ref;
+	struct rcu_head rcu;
+	struct root_profile profile;
+	// sorted, in init_user_ns, NULL if it couldn't be allocated
+	struct group_info *groups;
+	// sid of profile.selinux_domain, 0 until the first grant resolves it
+	u32 sid;
+};
+
 void ksu_allowlist_init(void);
 
 void ksu_allowlist_exit(void);
@@ -12,16 +32,43 @@ bool ksu_load_allow_list(void);
 
 void ksu_show_allow_list(void);
 
+// one bit per uid up to KSU_BITMAP_UID_MAX, set if it is allowed to su
+extern uint8_t ksu_allow_list_bitmap[PAGE_SIZE];
+#define KSU_BITMAP_UID_MAX (PAGE_SIZE * BITS_PER_BYTE - 1)
+
 bool __ksu_is_allow_uid(uid_t uid);
-#define ksu_is_allow_uid(uid) unlikely(__ksu_is_allow_uid(uid))
 
-bool ksu_get_allow_list(int *array, int *length, bool allow);
+/*
+ * Checked by the hooks of hot syscalls like stat, so app uids are answered by
+ * a single bit test without a call. Root and the uids of the other users take
+ * the slow path.
+ */
+static inline bool ksu_is_allow_uid_inline(uid_t uid)
+{
+	if (likely(uid && uid <= KSU_BITMAP_UID_MAX)) {
+		return READ_ONCE(ksu_allow_list_bitmap[uid / BITS_PER_BYTE]) &
+		       (1 << (uid % BITS_PER_BYTE));
+	}
+	return __ksu_is_allow_uid(uid);
+}
+#define ksu_is_allow_uid(uid) unlikely(ksu_is_allow_uid_inline(uid))
+
+u32 ksu_get_allow_list(int *array, u32 capacity, u32 cursor, u32 *next,
+		       bool allow);
+u32 ksu_get_allow_list_generation(void);
+int ksu_allow_list_notify_fd(void);
 
 void ksu_prune_allowlist(bool (*is_uid_exist)(uid_t, char *, void *), void *data);
 
 bool ksu_get_app_profile(struct app_profile *);
 bool ksu_set_app_profile(struct app_profile *, bool persist);
+bool ksu_set_root_profile_template(const char *name,
+				   const struct root_profile *profile);
+u32 ksu_get_app_profiles(struct app_profile *profiles, u32 cursor, u32 count,
+			 u32 *next);
 
 bool ksu_uid_should_umount(uid_t uid);
-struct root_profile *ksu_get_root_profile(uid_t uid);
+void ksu_get_umount_paths(uid_t uid, struct non_root_profile *profile);
+struct root_profile_holder *ksu_get_root_profile_holder(uid_t uid);
+void ksu_put_root_profile_holder(struct root_profile_holder *holder);
 #endif
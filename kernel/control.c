@@ -0,0 +1,276 @@
+#include "linux/anon_inodes.h"
+#include "linux/cred.h"
+#include "linux/err.h"
+#include "linux/fcntl.h"
+#include "linux/fs.h"
+#include "linux/kernel.h"
+#include "linux/ktime.h"
+#include "linux/slab.h"
+#include "linux/uaccess.h"
+
+#include "allowlist.h"
+#include "control.h"
+#include "core_hook.h"
+#include "klog.h" // IWYU pragma: keep
+#include "ksu.h"
+#include "ksud.h"
+#include "manager.h"
+#include "prctl_stats.h"
+#include "throttle.h"
+
+extern int handle_sepolicy(unsigned long arg3, void __user *arg4);
+
+/*
+ * The fd may be inherited or passed to other processes, so the permission is
+ * checked against the current caller for each command and not when the fd
+ * is installed.
+ */
+static bool perm_any(void)
+{
+	return true;
+}
+
+static bool perm_root(void)
+{
+	return current_uid().val == 0;
+}
+
+static bool perm_manager(void)
+{
+	return is_manager();
+}
+
+static bool perm_manager_or_root(void)
+{
+	return is_manager() || current_uid().val == 0;
+}
+
+static int do_get_info(void *arg)
+{
+	struct ksu_control_info *info = arg;
+
+	info->abi_version = KSU_CONTROL_ABI_VERSION;
+	info->version = KERNEL_SU_VERSION;
+	info->flags = 0;
+	if (is_manager())
+		info->flags |= KSU_INFO_MANAGER;
+	if (ksu_is_safe_mode())
+		info->flags |= KSU_INFO_SAFE_MODE;
+
+	return 0;
+}
+
+static int do_grant_root(void *arg)
+{
+	if (!is_manager() && !ksu_is_allow_uid(current_uid().val))
+		return -EPERM;
+
+	pr_info("allow root for: %d\n", current_uid().val);
+	escape_to_root();
+	return 0;
+}
+
+static int do_report_event(void *arg)
+{
+	ksu_report_event(*(u32 *)arg);
+	return 0;
+}
+
+static int do_set_sepolicy(void *arg)
+{
+	struct ksu_sepolicy_cmd *cmd = arg;
+
+	if (handle_sepolicy(cmd->cmd, (void __user *)(uintptr_t)cmd->arg))
+		return -EINVAL;
+
+	return 0;
+}
+
+static int do_get_uid_status(void *arg)
+{
+	struct ksu_uid_status *status = arg;
+
+	status->flags = 0;
+	if (ksu_is_allow_uid(status->uid))
+		status->flags |= KSU_UID_GRANTED_ROOT;
+	if (ksu_uid_should_umount(status->uid))
+		status->flags |= KSU_UID_SHOULD_UMOUNT;
+
+	return 0;
+}
+
+static int do_get_allow_list(void *arg)
+{
+	return ksu_handle_get_allow_list_page(arg) ? 0 : -EFAULT;
+}
+
+static int do_get_allow_list_notify_fd(void *arg)
+{
+	return ksu_allow_list_notify_fd();
+}
+
+static int do_get_app_profile(void *arg)
+{
+	return ksu_get_app_profile(arg) ? 0 : -ENOENT;
+}
+
+static int do_set_app_profile(void *arg)
+{
+	return ksu_set_app_profile(arg, true) ? 0 : -EINVAL;
+}
+
+static int do_get_app_profiles(void *arg)
+{
+	return ksu_handle_get_app_profiles(arg) ? 0 : -EFAULT;
+}
+
+static int do_set_app_profiles(void *arg)
+{
+	// count is updated to the profiles set even if some of them failed
+	ksu_handle_set_app_profiles(arg);
+	return 0;
+}
+
+static int do_set_root_profile_template(void *arg)
+{
+	struct root_profile_template *template = arg;
+
+	template->name[sizeof(template->name) - 1] = '\0';
+	return ksu_set_root_profile_template(template->name,
+					     &template->profile) ?
+		       0 :
+		       -EINVAL;
+}
+
+struct ksu_ioctl_cmd {
+	unsigned int cmd;
+	const char *name; // in <debugfs>/ksu/prctl_stats
+	bool (*perm)(void);
+	// arg is a kernel copy of the _IOC_SIZE(cmd) bytes argument
+	int (*handler)(void *arg);
+};
+
+#define KSU_IOCTL(_cmd, _name, _perm, _handler)                                \
+	[_IOC_NR(_cmd)] = {                                                    \
+		.cmd = _cmd,                                                   \
+		.name = _name,                                                 \
+		.perm = _perm,                                                 \
+		.handler = _handler,                                           \
+	}
+
+// indexed by the number of the command, holes have cmd 0 and never match
+static const struct ksu_ioctl_cmd ksu_ioctl_cmds[KSU_IOCTL_CMD_COUNT] = {
+	KSU_IOCTL(KSU_IOCTL_GET_INFO, "get_info", perm_manager_or_root,
+		  do_get_info),
+	KSU_IOCTL(KSU_IOCTL_GRANT_ROOT, "grant_root", perm_any, do_grant_root),
+	KSU_IOCTL(KSU_IOCTL_REPORT_EVENT, "report_event", perm_root,
+		  do_report_event),
+	KSU_IOCTL(KSU_IOCTL_SET_SEPOLICY, "set_sepolicy", perm_root,
+		  do_set_sepolicy),
+	KSU_IOCTL(KSU_IOCTL_GET_UID_STATUS, "get_uid_status",
+		  perm_manager_or_root, do_get_uid_status),
+	KSU_IOCTL(KSU_IOCTL_GET_ALLOW_LIST, "get_allow_list",
+		  perm_manager_or_root, do_get_allow_list),
+	KSU_IOCTL(KSU_IOCTL_GET_ALLOW_LIST_NOTIFY_FD,
+		  "get_allow_list_notify_fd", perm_manager_or_root,
+		  do_get_allow_list_notify_fd),
+	KSU_IOCTL(KSU_IOCTL_GET_APP_PROFILE, "get_app_profile", perm_manager,
+		  do_get_app_profile),
+	KSU_IOCTL(KSU_IOCTL_SET_APP_PROFILE, "set_app_profile", perm_manager,
+		  do_set_app_profile),
+	KSU_IOCTL(KSU_IOCTL_GET_APP_PROFILES, "get_app_profiles", perm_manager,
+		  do_get_app_profiles),
+	KSU_IOCTL(KSU_IOCTL_SET_APP_PROFILES, "set_app_profiles", perm_manager,
+		  do_set_app_profiles),
+	KSU_IOCTL(KSU_IOCTL_SET_ROOT_PROFILE_TEMPLATE,
+		  "set_root_profile_template", perm_manager_or_root,
+		  do_set_root_profile_template),
+};
+
+const char *ksu_ioctl_cmd_name(unsigned int nr)
+{
+	if (nr >= ARRAY_SIZE(ksu_ioctl_cmds))
+		return NULL;
+	return ksu_ioctl_cmds[nr].name;
+}
+
+static long ksu_control_ioctl(struct file *file, unsigned int cmd,
+			      unsigned long arg)
+{
+	void __user *uarg = (void __user *)arg;
+	const struct ksu_ioctl_cmd *c;
+	size_t size = _IOC_SIZE(cmd);
+	unsigned int nr = _IOC_NR(cmd);
+	void *data = NULL;
+	u64 start = 0;
+	long ret;
+
+	if (_IOC_TYPE(cmd) != KSU_IOCTL_MAGIC ||
+	    nr >= ARRAY_SIZE(ksu_ioctl_cmds))
+		return -ENOTTY;
+
+	// the whole cmd is compared, so a caller with another size is rejected
+	c = &ksu_ioctl_cmds[nr];
+	if (c->cmd != cmd)
+		return -ENOTTY;
+
+	// the same filters as the prctl, holding the fd doesn't bypass them
+	if (is_isolated_uid(current_uid().val))
+		return -EPERM;
+
+	if (ksu_uid_throttled(current_uid().val))
+		return -EAGAIN;
+
+	if (!c->perm()) {
+		// manager only cmds are probed by nobody else
+		if (c->perm == perm_manager)
+			ksu_uid_failed(current_uid().val);
+		ksu_ioctl_cmd_account(nr, KSU_PRCTL_DENIED, 0);
+		return -EPERM;
+	}
+
+	if (size) {
+		data = kzalloc(size, GFP_KERNEL);
+		if (!data)
+			return -ENOMEM;
+		if ((_IOC_DIR(cmd) & _IOC_WRITE) &&
+		    copy_from_user(data, uarg, size)) {
+			ret = -EFAULT;
+			goto out;
+		}
+	}
+
+#ifdef CONFIG_KSU_DEBUG
+	pr_info("ioctl: %d, uid: %d\n", nr, current_uid().val);
+#endif
+
+	if (ksu_prctl_cmd_stats_enabled())
+		start = ktime_get_ns();
+
+	ret = c->handler(data);
+	if (ret >= 0 && (_IOC_DIR(cmd) & _IOC_READ) &&
+	    copy_to_user(uarg, data, size))
+		ret = -EFAULT;
+
+	if (start)
+		ksu_ioctl_cmd_account(nr,
+				      ret < 0 ? KSU_PRCTL_FAILED : KSU_PRCTL_OK,
+				      ktime_get_ns() - start);
+out:
+	kfree(data);
+	return ret;
+}
+
+static const struct file_operations ksu_control_fops = {
+	.owner = THIS_MODULE,
+	.unlocked_ioctl = ksu_control_ioctl,
+	// the arguments have the same layout for 32 bit processes
+	.compat_ioctl = ksu_control_ioctl,
+	.llseek = noop_llseek,
+};
+
+int ksu_install_control_fd(void)
+{
+	return anon_inode_getfd("[ksu_control]", &ksu_control_fops, NULL,
+				O_RDWR | O_CLOEXEC);
+}
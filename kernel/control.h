@@ -0,0 +1,7 @@
+#ifndef __KSU_H_CONTROL
+#define __KSU_H_CONTROL
+
+// returns a fd taking KSU_IOCTL_* or a negative errno
+int ksu_install_control_fd(void);
+
+#endif
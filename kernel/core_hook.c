@@ -6,28 +6,37 @@
 #include "linux/init_task.h"
 #include "linux/kernel.h"
 #include "linux/kprobes.h"
+#include "linux/ktime.h"
 #include "linux/lsm_hooks.h"
 #include "linux/nsproxy.h"
 #include "linux/path.h"
 #include "linux/printk.h"
 #include "linux/uaccess.h"
 #include "linux/uidgid.h"
+#include "linux/user_namespace.h"
 #include "linux/version.h"
 #include "linux/mount.h"
 
 #include "linux/fs.h"
 #include "linux/namei.h"
 #include "linux/rcupdate.h"
+#include "linux/slab.h"
 
 #include "allowlist.h"
 #include "arch.h"
+#include "control.h"
 #include "core_hook.h"
 #include "klog.h" // IWYU pragma: keep
 #include "ksu.h"
 #include "ksud.h"
 #include "manager.h"
+#include "prctl_stats.h"
+#include "profile_tlv.h"
 #include "selinux/selinux.h"
+#include "sucompat.h"
+#include "throttle.h"
 #include "uid_observer.h"
+#include "umount.h"
 #include "kernel_compat.h"
 
 static bool ksu_module_mounted = false;
@@ -43,51 +52,38 @@ static inline bool is_allow_su()
 	return ksu_is_allow_uid(current_uid().val);
 }
 
-static inline bool is_isolated_uid(uid_t uid)
-{
-#define FIRST_ISOLATED_UID 99000
-#define LAST_ISOLATED_UID 99999
-#define FIRST_APP_ZYGOTE_ISOLATED_UID 90000
-#define LAST_APP_ZYGOTE_ISOLATED_UID 98999
-	uid_t appid = uid % 100000;
-	return (appid >= FIRST_ISOLATED_UID && appid <= LAST_ISOLATED_UID) ||
-	       (appid >= FIRST_APP_ZYGOTE_ISOLATED_UID &&
-		appid <= LAST_APP_ZYGOTE_ISOLATED_UID);
-}
-
 static struct group_info root_groups = { .usage = ATOMIC_INIT(2) };
 
-static void setup_groups(struct root_profile *profile, struct cred *cred)
+struct group_info *ksu_alloc_root_groups(const struct root_profile *profile,
+					 struct user_namespace *ns)
 {
-	if (profile->groups_count > KSU_MAX_GROUPS) {
+	if (profile->groups_count > KSU_MAX_GROUPS ||
+	    profile->groups_count < 0) {
 		pr_warn("Failed to setgroups, too large group: %d!\n",
 			profile->uid);
-		return;
+		return NULL;
 	}
 
 	if (profile->groups_count == 1 && profile->groups[0] == 0) {
-		// setgroup to root and return early.
-		if (cred->group_info)
-			put_group_info(cred->group_info);
-		cred->group_info = get_group_info(&root_groups);
-		return;
+		// setgroup to root
+		return get_group_info(&root_groups);
 	}
 
 	u32 ngroups = profile->groups_count;
 	struct group_info *group_info = groups_alloc(ngroups);
 	if (!group_info) {
 		pr_warn("Failed to setgroups, ENOMEM for: %d\n", profile->uid);
-		return;
+		return NULL;
 	}
 
 	int i;
 	for (i = 0; i < ngroups; i++) {
 		gid_t gid = profile->groups[i];
-		kgid_t kgid = make_kgid(current_user_ns(), gid);
+		kgid_t kgid = make_kgid(ns, gid);
 		if (!gid_valid(kgid)) {
 			pr_warn("Failed to setgroups, invalid gid: %d\n", gid);
 			put_group_info(group_info);
-			return;
+			return NULL;
 		}
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 9, 0)
 		group_info->gid[i] = kgid;
@@ -97,7 +93,41 @@ static void setup_groups(struct root_profile *profile, struct cred *cred)
 	}
 
 	groups_sort(group_info);
-	set_groups(cred, group_info);
+	return group_info;
+}
+
+static void setup_groups(struct root_profile_holder *holder, struct cred *cred)
+{
+	struct group_info *group_info = NULL;
+
+	// the prepared groups are only valid for init_user_ns
+	if (holder->groups && current_user_ns() == &init_user_ns) {
+		set_groups(cred, holder->groups);
+		return;
+	}
+
+	group_info = ksu_alloc_root_groups(&holder->profile, current_user_ns());
+	if (group_info) {
+		set_groups(cred, group_info);
+		put_group_info(group_info);
+	}
+}
+
+static void setup_domain(struct root_profile_holder *holder)
+{
+	u32 sid = READ_ONCE(holder->sid);
+
+	if (!sid) {
+		sid = ksu_domain_to_sid(holder->profile.selinux_domain);
+		if (!sid) {
+			pr_err("transive domain failed.\n");
+			return;
+		}
+		// all the grants resolve the same sid, any of them can win
+		WRITE_ONCE(holder->sid, sid);
+	}
+
+	setup_selinux_sid(sid);
 }
 
 void escape_to_root(void)
@@ -110,7 +140,13 @@ void escape_to_root(void)
 		pr_warn("Already root, don't escape!\n");
 		return;
 	}
-	struct root_profile *profile = ksu_get_root_profile(cred->uid.val);
+	struct root_profile_holder *holder =
+		ksu_get_root_profile_holder(cred->uid.val);
+	if (!holder) {
+		pr_err("no root profile for: %d\n", cred->uid.val);
+		return;
+	}
+	struct root_profile *profile = &holder->profile;
 
 	cred->uid.val = profile->uid;
 	cred->suid.val = profile->uid;
@@ -155,9 +191,11 @@ void escape_to_root(void)
 #else
 #endif
 
-	setup_groups(profile, cred);
+	setup_groups(holder, cred);
 
-	setup_selinux(profile->selinux_domain);
+	setup_domain(holder);
+
+	ksu_put_root_profile_holder(holder);
 }
 
 int ksu_handle_rename(struct dentry *old_dentry, struct dentry *new_dentry)
@@ -510,6 +548,9 @@ static int my_register_breakpoint(struct perf_event **p_sample_hbp, pid_t pid,
 	return 0;
 }
 
+// options KERNEL_SU_OPTION + 1 ... + KSU_HACK_OPTION_MAX
+#define KSU_HACK_OPTION_MAX 6
+
 static int hack_handle_prctl(int option, unsigned long arg2, unsigned long arg3,
 			     unsigned long arg4, unsigned long arg5)
 {
@@ -657,341 +698,709 @@ static int hack_handle_prctl(int option, unsigned long arg2, unsigned long arg3,
 	}
 	return 0;
 }
-int ksu_handle_prctl(int option, unsigned long arg2, unsigned long arg3,
-		     unsigned long arg4, unsigned long arg5)
-{
-	hack_handle_prctl(option, arg2, arg3, arg4, arg5);
-	// if success, we modify the arg5 as result!
-	u32 *result = (u32 *)arg5;
-	u32 reply_ok = KERNEL_SU_OPTION;
+// profiles are copied to user space in chunks to keep the buffer small
+#define KSU_PROFILE_BATCH_CHUNK 16
 
-	if (KERNEL_SU_OPTION != option) {
-		return 0;
+bool ksu_handle_get_app_profiles(struct app_profile_batch *batch)
+{
+	struct app_profile __user *profiles =
+		(struct app_profile __user *)(uintptr_t)batch->profiles;
+	struct app_profile *chunk = NULL;
+	u32 cursor = batch->cursor;
+	u32 filled = 0;
+	bool ok = true;
+
+	chunk = kmalloc_array(KSU_PROFILE_BATCH_CHUNK, sizeof(*chunk),
+			      GFP_KERNEL);
+	if (!chunk) {
+		return false;
 	}
 
-	// always ignore isolated app uid
-	if (is_isolated_uid(current_uid().val)) {
-		return 0;
+	while (filled < batch->count) {
+		u32 want = min_t(u32, batch->count - filled,
+				 KSU_PROFILE_BATCH_CHUNK);
+		u32 n = ksu_get_app_profiles(chunk, cursor, want, &cursor);
+		if (n && copy_to_user(profiles + filled, chunk,
+				      n * sizeof(*chunk))) {
+			pr_err("get_app_profiles: copy profiles failed\n");
+			ok = false;
+			break;
+		}
+		filled += n;
+		if (!cursor) {
+			break;
+		}
 	}
+	kfree(chunk);
 
-	static uid_t last_failed_uid = -1;
-	if (last_failed_uid == current_uid().val) {
-		return 0;
-	}
+	batch->cursor = cursor;
+	batch->count = filled;
+	return ok;
+}
 
-#ifdef CONFIG_KSU_DEBUG
-	pr_info("option: 0x%x, cmd: %ld\n", option, arg2);
-#endif
+bool ksu_handle_set_app_profiles(struct app_profile_batch *batch)
+{
+	struct app_profile __user *profiles =
+		(struct app_profile __user *)(uintptr_t)batch->profiles;
+	struct app_profile *profile = NULL;
+	u32 count = batch->count;
+	u32 i;
+	u32 done = 0;
+
+	profile = kmalloc(sizeof(*profile), GFP_KERNEL);
+	if (!profile) {
+		return false;
+	}
 
-	if (arg2 == CMD_BECOME_MANAGER) {
-		// quick check
-		if (is_manager()) {
-			if (copy_to_user(result, &reply_ok, sizeof(reply_ok))) {
-				pr_err("become_manager: prctl reply error\n");
-			}
-			return 0;
+	for (i = 0; i < count; i++) {
+		if (copy_from_user(profile, profiles + i, sizeof(*profile))) {
+			pr_err("set_app_profiles: copy profile failed\n");
+			break;
 		}
-		if (ksu_is_manager_uid_valid()) {
-#ifdef CONFIG_KSU_DEBUG
-			pr_info("manager already exist: %d\n",
-				ksu_get_manager_uid());
-#endif	
-			return 0;
+		// saving is coalesced, so persisting each of them is cheap
+		if (ksu_set_app_profile(profile, true)) {
+			done++;
 		}
+	}
+	kfree(profile);
 
-		// someone wants to be root manager, just check it!
-		// arg3 should be `/data/user/<userId>/<manager_package_name>`
-		char param[128];
-		if (ksu_strncpy_from_user_nofault(param, arg3, sizeof(param)) ==
-		    -EFAULT) {
-#ifdef CONFIG_KSU_DEBUG
-			pr_err("become_manager: copy param err\n");
-#endif
-			goto block;
-		}
+	batch->count = done;
+	return done == count;
+}
 
-		// for user 0, it is /data/data
-		// for user 999, it is /data/user/999
-		const char *prefix;
-		char prefixTmp[64];
-		int userId = current_uid().val / 100000;
-		if (userId == 0) {
-			prefix = "/data/data";
-		} else {
-			snprintf(prefixTmp, sizeof(prefixTmp), "/data/user/%d",
-				 userId);
-			prefix = prefixTmp;
-		}
+/*
+ * CMD_GET_APP_PROFILE_TLV looks up the profile by the current_uid of the
+ * encoded profile in the buffer, then the buffer which must have room for
+ * KSU_PROFILE_TLV_MAX bytes is overwritten with the encoded result.
+ * *ulen is the length of the encoded profile, it is set to 0 if not found.
+ */
+static bool get_app_profile_tlv(void __user *ubuf, u32 __user *ulen)
+{
+	struct app_profile *profile = NULL;
+	u8 *buf = NULL;
+	ssize_t size;
+	u32 len;
+	bool found = false;
 
-		if (startswith(param, (char *)prefix) != 0) {
-			pr_info("become_manager: invalid param: %s\n", param);
-			goto block;
-		}
+	if (get_user(len, ulen) || len > KSU_PROFILE_TLV_MAX) {
+		return false;
+	}
 
-		// stat the param, app must have permission to do this
-		// otherwise it may fake the path!
-		struct path path;
-		if (kern_path(param, LOOKUP_DIRECTORY, &path)) {
-			pr_err("become_manager: kern_path err\n");
-			goto block;
-		}
-		uid_t inode_uid = path.dentry->d_inode->i_uid.val;
-		path_put(&path);
-		if (inode_uid != current_uid().val) {
-			pr_err("become_manager: path uid != current uid\n");
-			goto block;
-		}
-		char *pkg = param + strlen(prefix);
-		pr_info("become_manager: param pkg: %s\n", pkg);
+	buf = kmalloc(KSU_PROFILE_TLV_MAX, GFP_KERNEL);
+	profile = kmalloc(sizeof(*profile), GFP_KERNEL);
+	if (!buf || !profile) {
+		goto out;
+	}
 
-		bool success = become_manager(pkg);
-		if (success) {
-			if (copy_to_user(result, &reply_ok, sizeof(reply_ok))) {
-				pr_err("become_manager: prctl reply error\n");
-			}
-			return 0;
-		}
-	block:
-		last_failed_uid = current_uid().val;
-		return 0;
+	if (copy_from_user(buf, ubuf, len) ||
+	    ksu_profile_tlv_decode(buf, len, profile)) {
+		goto out;
 	}
 
-	if (arg2 == CMD_GRANT_ROOT) {
-		if (is_allow_su()) {
-			pr_info("allow root for: %d\n", current_uid().val);
-			escape_to_root();
-			if (copy_to_user(result, &reply_ok, sizeof(reply_ok))) {
-				pr_err("grant_root: prctl reply error\n");
-			}
-		}
-		return 0;
+	found = ksu_get_app_profile(profile);
+	if (!found) {
+		put_user(0, ulen);
+		goto out;
 	}
 
-	// Both root manager and root processes should be allowed to get version
-	if (arg2 == CMD_GET_VERSION) {
-		if (is_manager() || 0 == current_uid().val) {
-			u32 version = KERNEL_SU_VERSION;
-			if (copy_to_user(arg3, &version, sizeof(version))) {
-				pr_err("prctl reply error, cmd: %lu\n", arg2);
-			}
-		}
-		return 0;
+	size = ksu_profile_tlv_encode(profile, buf, KSU_PROFILE_TLV_MAX);
+	found = size > 0 && !copy_to_user(ubuf, buf, size) &&
+		!put_user((u32)size, ulen);
+out:
+	kfree(profile);
+	kfree(buf);
+	return found;
+}
+
+static bool set_app_profile_tlv(const void __user *ubuf, u32 __user *ulen)
+{
+	struct app_profile *profile = NULL;
+	u8 *buf = NULL;
+	u32 len;
+	bool success = false;
+
+	if (get_user(len, ulen) || len > KSU_PROFILE_TLV_MAX) {
+		return false;
 	}
 
-	if (arg2 == CMD_REPORT_EVENT) {
-		if (0 != current_uid().val) {
-			return 0;
-		}
-		switch (arg3) {
-		case EVENT_POST_FS_DATA: {
-			static bool post_fs_data_lock = false;
-			if (!post_fs_data_lock) {
-				post_fs_data_lock = true;
-				pr_info("post-fs-data triggered\n");
-				on_post_fs_data();
-			}
-			break;
-		}
-		case EVENT_BOOT_COMPLETED: {
-			static bool boot_complete_lock = false;
-			if (!boot_complete_lock) {
-				boot_complete_lock = true;
-				pr_info("boot_complete triggered\n");
-			}
-			break;
-		}
-		case EVENT_MODULE_MOUNTED: {
-			ksu_module_mounted = true;
-			pr_info("module mounted!\n");
+	buf = kmalloc(KSU_PROFILE_TLV_MAX, GFP_KERNEL);
+	profile = kmalloc(sizeof(*profile), GFP_KERNEL);
+	if (!buf || !profile) {
+		goto out;
+	}
+
+	if (!copy_from_user(buf, ubuf, len) &&
+	    !ksu_profile_tlv_decode(buf, len, profile)) {
+		success = ksu_set_app_profile(profile, true);
+	}
+out:
+	kfree(profile);
+	kfree(buf);
+	return success;
+}
+
+#define KSU_ALLOW_LIST_CHUNK 128
+
+bool ksu_handle_get_allow_list_page(struct allow_list_page *page)
+{
+	u32 __user *uids = (u32 __user *)(uintptr_t)page->uids;
+	u32 generation = ksu_get_allow_list_generation();
+	u32 cursor = page->cursor;
+	u32 filled = 0;
+	int *chunk = NULL;
+	bool ok = true;
+
+	if (page->generation == generation && page->cursor == 0) {
+		// nothing changed since the caller's last fetch
+		page->count = 0;
+		return true;
+	}
+
+	chunk = kmalloc_array(KSU_ALLOW_LIST_CHUNK, sizeof(*chunk), GFP_KERNEL);
+	if (!chunk) {
+		return false;
+	}
+
+	while (filled < page->count) {
+		u32 want = min_t(u32, page->count - filled,
+				 KSU_ALLOW_LIST_CHUNK);
+		u32 n = ksu_get_allow_list(chunk, want, cursor, &cursor,
+					   page->allow);
+		if (n && copy_to_user(uids + filled, chunk,
+				      n * sizeof(*chunk))) {
+			pr_err("get_allow_list_page: copy uids failed\n");
+			ok = false;
 			break;
 		}
-		default:
+		filled += n;
+		if (!cursor) {
 			break;
 		}
-		return 0;
 	}
+	kfree(chunk);
 
-	if (arg2 == CMD_SET_SEPOLICY) {
-		if (0 != current_uid().val) {
-			return 0;
+	page->generation = generation;
+	page->cursor = cursor;
+	page->count = filled;
+	return ok;
+}
+
+void ksu_report_event(unsigned long event)
+{
+	switch (event) {
+	case EVENT_POST_FS_DATA: {
+		static bool post_fs_data_lock = false;
+		if (!post_fs_data_lock) {
+			post_fs_data_lock = true;
+			pr_info("post-fs-data triggered\n");
+			on_post_fs_data();
 		}
-		if (!handle_sepolicy(arg3, arg4)) {
-			if (copy_to_user(result, &reply_ok, sizeof(reply_ok))) {
-				pr_err("sepolicy: prctl reply error\n");
-			}
+		break;
+	}
+	case EVENT_BOOT_COMPLETED: {
+		static bool boot_complete_lock = false;
+		if (!boot_complete_lock) {
+			boot_complete_lock = true;
+			pr_info("boot_complete triggered\n");
 		}
+		break;
+	}
+	case EVENT_MODULE_MOUNTED: {
+		ksu_module_mounted = true;
+		pr_info("module mounted!\n");
+		break;
+	}
+	default:
+		break;
+	}
+}
 
-		return 0;
+// failed to become manager or called a manager only cmd
+static void block_current_uid(void)
+{
+	ksu_uid_failed(current_uid().val);
+}
+
+static bool prctl_become_manager(unsigned long arg3, unsigned long arg4)
+{
+	// quick check
+	if (is_manager()) {
+		return true;
+	}
+	if (ksu_is_manager_uid_valid()) {
+#ifdef CONFIG_KSU_DEBUG
+		pr_info("manager already exist: %d\n", ksu_get_manager_uid());
+#endif
+		return false;
 	}
 
-	if (arg2 == CMD_CHECK_SAFEMODE) {
-		if (!is_manager() && 0 != current_uid().val) {
-			return 0;
-		}
-		if (ksu_is_safe_mode()) {
-			pr_warn("safemode enabled!\n");
-			if (copy_to_user(result, &reply_ok, sizeof(reply_ok))) {
-				pr_err("safemode: prctl reply error\n");
-			}
-		}
-		return 0;
+	// someone wants to be root manager, just check it!
+	// arg3 should be `/data/user/<userId>/<manager_package_name>`
+	char param[128];
+	if (ksu_strncpy_from_user_nofault(param, arg3, sizeof(param)) ==
+	    -EFAULT) {
+#ifdef CONFIG_KSU_DEBUG
+		pr_err("become_manager: copy param err\n");
+#endif
+		goto block;
 	}
 
-	if (arg2 == CMD_GET_ALLOW_LIST || arg2 == CMD_GET_DENY_LIST) {
-		if (is_manager() || 0 == current_uid().val) {
-			u32 array[128];
-			u32 array_length;
-			bool success =
-				ksu_get_allow_list(array, &array_length,
-						   arg2 == CMD_GET_ALLOW_LIST);
-			if (success) {
-				if (!copy_to_user(arg4, &array_length,
-						  sizeof(array_length)) &&
-				    !copy_to_user(arg3, array,
-						  sizeof(u32) * array_length)) {
-					if (copy_to_user(result, &reply_ok,
-							 sizeof(reply_ok))) {
-						pr_err("prctl reply error, cmd: %lu\n",
-						       arg2);
-					}
-				} else {
-					pr_err("prctl copy allowlist error\n");
-				}
-			}
-		}
-		return 0;
+	// for user 0, it is /data/data
+	// for user 999, it is /data/user/999
+	const char *prefix;
+	char prefixTmp[64];
+	int userId = current_uid().val / 100000;
+	if (userId == 0) {
+		prefix = "/data/data";
+	} else {
+		snprintf(prefixTmp, sizeof(prefixTmp), "/data/user/%d", userId);
+		prefix = prefixTmp;
 	}
 
-	if (arg2 == CMD_UID_GRANTED_ROOT || arg2 == CMD_UID_SHOULD_UMOUNT) {
-		if (is_manager() || 0 == current_uid().val) {
-			uid_t target_uid = (uid_t)arg3;
-			bool allow = false;
-			if (arg2 == CMD_UID_GRANTED_ROOT) {
-				allow = ksu_is_allow_uid(target_uid);
-			} else if (arg2 == CMD_UID_SHOULD_UMOUNT) {
-				allow = ksu_uid_should_umount(target_uid);
-			} else {
-				pr_err("unknown cmd: %lu\n", arg2);
-			}
-			if (!copy_to_user(arg4, &allow, sizeof(allow))) {
-				if (copy_to_user(result, &reply_ok,
-						 sizeof(reply_ok))) {
-					pr_err("prctl reply error, cmd: %lu\n",
-					       arg2);
-				}
-			} else {
-				pr_err("prctl copy err, cmd: %lu\n", arg2);
-			}
-		}
-		return 0;
+	if (startswith(param, (char *)prefix) != 0) {
+		pr_info("become_manager: invalid param: %s\n", param);
+		goto block;
 	}
 
-	// all other cmds are for 'root manager'
-	if (!is_manager()) {
-		last_failed_uid = current_uid().val;
-		return 0;
+	// stat the param, app must have permission to do this
+	// otherwise it may fake the path!
+	struct path path;
+	if (kern_path(param, LOOKUP_DIRECTORY, &path)) {
+		pr_err("become_manager: kern_path err\n");
+		goto block;
+	}
+	uid_t inode_uid = path.dentry->d_inode->i_uid.val;
+	path_put(&path);
+	if (inode_uid != current_uid().val) {
+		pr_err("become_manager: path uid != current uid\n");
+		goto block;
 	}
+	char *pkg = param + strlen(prefix);
+	pr_info("become_manager: param pkg: %s\n", pkg);
 
-	// we are already manager
-	if (arg2 == CMD_GET_APP_PROFILE) {
-		struct app_profile profile;
-		if (copy_from_user(&profile, arg3, sizeof(profile))) {
-			pr_err("copy profile failed\n");
-			return 0;
-		}
+	if (become_manager(pkg)) {
+		return true;
+	}
+block:
+	block_current_uid();
+	return false;
+}
 
-		bool success = ksu_get_app_profile(&profile);
-		if (success) {
-			if (copy_to_user(arg3, &profile, sizeof(profile))) {
-				pr_err("copy profile failed\n");
-				return 0;
-			}
-			if (copy_to_user(result, &reply_ok, sizeof(reply_ok))) {
-				pr_err("prctl reply error, cmd: %lu\n", arg2);
-			}
-		}
-		return 0;
+static bool prctl_grant_root(unsigned long arg3, unsigned long arg4)
+{
+	if (!is_allow_su()) {
+		return false;
 	}
+	pr_info("allow root for: %d\n", current_uid().val);
+	escape_to_root();
+	return true;
+}
 
-	if (arg2 == CMD_SET_APP_PROFILE) {
-		struct app_profile profile;
-		if (copy_from_user(&profile, arg3, sizeof(profile))) {
-			pr_err("copy profile failed\n");
-			return 0;
-		}
+static bool prctl_get_version(unsigned long arg3, unsigned long arg4)
+{
+	u32 version = KERNEL_SU_VERSION;
+	return !copy_to_user(arg3, &version, sizeof(version));
+}
 
-		// todo: validate the params
-		if (ksu_set_app_profile(&profile, true)) {
-			if (copy_to_user(result, &reply_ok, sizeof(reply_ok))) {
-				pr_err("prctl reply error, cmd: %lu\n", arg2);
-			}
-		}
-		return 0;
+static bool prctl_report_event(unsigned long arg3, unsigned long arg4)
+{
+	ksu_report_event(arg3);
+	return true;
+}
+
+static bool prctl_set_sepolicy(unsigned long arg3, unsigned long arg4)
+{
+	return !handle_sepolicy(arg3, (void __user *)arg4);
+}
+
+static bool prctl_check_safemode(unsigned long arg3, unsigned long arg4)
+{
+	if (!ksu_is_safe_mode()) {
+		return false;
 	}
+	pr_warn("safemode enabled!\n");
+	return true;
+}
 
-	return 0;
+static bool prctl_get_allow_list(unsigned long arg3, unsigned long arg4)
+{
+	// legacy interface, the caller can't tell us the capacity
+	int array[128];
+	u32 next;
+	u32 array_length = ksu_get_allow_list(array, ARRAY_SIZE(array), 0,
+					      &next, true);
+	if (copy_to_user(arg4, &array_length, sizeof(array_length)) ||
+	    copy_to_user(arg3, array, sizeof(u32) * array_length)) {
+		pr_err("prctl copy allowlist error\n");
+		return false;
+	}
+	return true;
 }
 
-static bool is_appuid(kuid_t uid)
+static bool prctl_get_deny_list(unsigned long arg3, unsigned long arg4)
 {
-#define PER_USER_RANGE 100000
-#define FIRST_APPLICATION_UID 10000
-#define LAST_APPLICATION_UID 19999
+	int array[128];
+	u32 next;
+	u32 array_length = ksu_get_allow_list(array, ARRAY_SIZE(array), 0,
+					      &next, false);
+	if (copy_to_user(arg4, &array_length, sizeof(array_length)) ||
+	    copy_to_user(arg3, array, sizeof(u32) * array_length)) {
+		pr_err("prctl copy denylist error\n");
+		return false;
+	}
+	return true;
+}
 
-	uid_t appid = uid.val % PER_USER_RANGE;
-	return appid >= FIRST_APPLICATION_UID && appid <= LAST_APPLICATION_UID;
+static bool prctl_get_allow_list_paged(unsigned long arg3, unsigned long arg4)
+{
+	struct allow_list_page page;
+	if (copy_from_user(&page, arg3, sizeof(page))) {
+		pr_err("copy allow list page failed\n");
+		return false;
+	}
+	return ksu_handle_get_allow_list_page(&page) &&
+	       !copy_to_user(arg3, &page, sizeof(page));
 }
 
-static bool should_umount(struct path *path)
+static bool prctl_get_allow_list_notify_fd(unsigned long arg3,
+					   unsigned long arg4)
 {
-	if (!path) {
+	int fd = ksu_allow_list_notify_fd();
+	if (fd < 0) {
+		pr_err("allow list notify fd failed: %d\n", fd);
+		return false;
+	}
+	if (copy_to_user(arg3, &fd, sizeof(fd))) {
+		pr_err("prctl copy allow list notify fd err\n");
 		return false;
 	}
+	return true;
+}
 
-	if (current->nsproxy->mnt_ns == init_nsproxy.mnt_ns) {
-		pr_info("ignore global mnt namespace process: %d\n",
-			current_uid().val);
+static bool prctl_get_control_fd(unsigned long arg3, unsigned long arg4)
+{
+	int fd = ksu_install_control_fd();
+	if (fd < 0) {
+		pr_err("install control fd failed: %d\n", fd);
 		return false;
 	}
+	if (copy_to_user(arg3, &fd, sizeof(fd))) {
+		pr_err("prctl copy control fd err\n");
+		return false;
+	}
+	return true;
+}
 
-	if (path->mnt && path->mnt->mnt_sb && path->mnt->mnt_sb->s_type) {
-		const char *fstype = path->mnt->mnt_sb->s_type->name;
-		return strcmp(fstype, "overlay") == 0;
+static bool prctl_set_root_profile_template(unsigned long arg3,
+					    unsigned long arg4)
+{
+	struct root_profile_template *template =
+		kmalloc(sizeof(*template), GFP_KERNEL);
+	bool success = false;
+
+	if (!template) {
+		return false;
 	}
-	return false;
+	if (copy_from_user(template, arg3, sizeof(*template))) {
+		pr_err("copy root profile template failed\n");
+		goto out;
+	}
+	template->name[sizeof(template->name) - 1] = '\0';
+	success = ksu_set_root_profile_template(template->name,
+						&template->profile);
+out:
+	kfree(template);
+	return success;
 }
 
-static void ksu_umount_mnt(struct path *path, int flags)
+static bool prctl_add_try_umount(unsigned long arg3, unsigned long arg4)
 {
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 9, 0)
-	int err = path_umount(path, flags);
+	char path[256];
+	long len;
+	int err;
+
+	// NULL clears the list, ksud does it before adding the mounts of this boot
+	if (!arg3) {
+		ksu_clear_try_umount();
+		return true;
+	}
+
+	len = strncpy_from_user(path, (const char __user *)arg3, sizeof(path));
+	if (len <= 0 || len >= sizeof(path)) {
+		pr_err("prctl copy try umount path failed: %ld\n", len);
+		return false;
+	}
+
+	err = ksu_add_try_umount(path, (int)arg4);
 	if (err) {
-		pr_info("umount %s failed: %d\n", path->dentry->d_iname, err);
+		pr_err("add try umount %s failed: %d\n", path, err);
+		return false;
 	}
-#else
-	// TODO: umount for non GKI kernel
-#endif
+	return true;
 }
 
-static void try_umount(const char *mnt, bool check_mnt, int flags)
+static bool prctl_enable_su(unsigned long arg3, unsigned long arg4)
 {
-	struct path path;
-	int err = kern_path(mnt, 0, &path);
-	if (err) {
-		return;
+	ksu_set_sucompat(!!arg3);
+	return true;
+}
+
+static bool prctl_is_su_enabled(unsigned long arg3, unsigned long arg4)
+{
+	bool enabled = ksu_sucompat_enabled();
+	return !copy_to_user(arg3, &enabled, sizeof(enabled));
+}
+
+static bool prctl_uid_granted_root(unsigned long arg3, unsigned long arg4)
+{
+	bool allow = ksu_is_allow_uid((uid_t)arg3);
+	return !copy_to_user(arg4, &allow, sizeof(allow));
+}
+
+static bool prctl_uid_should_umount(unsigned long arg3, unsigned long arg4)
+{
+	bool allow = ksu_uid_should_umount((uid_t)arg3);
+	return !copy_to_user(arg4, &allow, sizeof(allow));
+}
+
+static bool prctl_get_app_profile(unsigned long arg3, unsigned long arg4)
+{
+	struct app_profile profile;
+	if (copy_from_user(&profile, arg3, sizeof(profile))) {
+		pr_err("copy profile failed\n");
+		return false;
+	}
+	if (!ksu_get_app_profile(&profile)) {
+		return false;
+	}
+	if (copy_to_user(arg3, &profile, sizeof(profile))) {
+		pr_err("copy profile failed\n");
+		return false;
 	}
+	return true;
+}
 
-	if (path.dentry != path.mnt->mnt_root) {
-		// it is not root mountpoint, maybe umounted by others already.
-		return;
+static bool prctl_set_app_profile(unsigned long arg3, unsigned long arg4)
+{
+	struct app_profile profile;
+	if (copy_from_user(&profile, arg3, sizeof(profile))) {
+		pr_err("copy profile failed\n");
+		return false;
 	}
+	// todo: validate the params
+	return ksu_set_app_profile(&profile, true);
+}
 
-	// we are only interest in some specific mounts
-	if (check_mnt && !should_umount(&path)) {
-		return;
+static bool prctl_get_app_profile_tlv(unsigned long arg3, unsigned long arg4)
+{
+	return get_app_profile_tlv((void __user *)arg3, (u32 __user *)arg4);
+}
+
+static bool prctl_set_app_profile_tlv(unsigned long arg3, unsigned long arg4)
+{
+	return set_app_profile_tlv((void __user *)arg3, (u32 __user *)arg4);
+}
+
+static bool prctl_app_profiles(unsigned long arg3, bool get)
+{
+	struct app_profile_batch batch;
+	bool success;
+	if (copy_from_user(&batch, arg3, sizeof(batch))) {
+		pr_err("copy profile batch failed\n");
+		return false;
+	}
+
+	if (get) {
+		success = ksu_handle_get_app_profiles(&batch);
+	} else {
+		success = ksu_handle_set_app_profiles(&batch);
+	}
+
+	if (copy_to_user(arg3, &batch, sizeof(batch))) {
+		pr_err("copy profile batch failed\n");
+		return false;
+	}
+	return success;
+}
+
+static bool prctl_get_app_profiles(unsigned long arg3, unsigned long arg4)
+{
+	return prctl_app_profiles(arg3, true);
+}
+
+static bool prctl_set_app_profiles(unsigned long arg3, unsigned long arg4)
+{
+	return prctl_app_profiles(arg3, false);
+}
+
+#define KSU_PERM_ANY 0
+#define KSU_PERM_ROOT (1 << 0)
+#define KSU_PERM_MANAGER (1 << 1)
+
+struct ksu_prctl_cmd {
+	const char *name;
+	// KSU_PERM_*, the caller must match one of them
+	u32 perm;
+	// reply KERNEL_SU_OPTION to arg5 if true
+	bool (*handler)(unsigned long arg3, unsigned long arg4);
+};
+
+#define KSU_PRCTL(_cmd, _name, _perm, _handler)                                \
+	[_cmd] = { .name = _name, .perm = _perm, .handler = _handler }
+
+// indexed by arg2, holes have no handler
+static const struct ksu_prctl_cmd ksu_prctl_cmds[KSU_PRCTL_CMD_COUNT] = {
+	KSU_PRCTL(CMD_GRANT_ROOT, "grant_root", KSU_PERM_ANY,
+		  prctl_grant_root),
+	KSU_PRCTL(CMD_BECOME_MANAGER, "become_manager", KSU_PERM_ANY,
+		  prctl_become_manager),
+	// Both root manager and root processes should be allowed to get version
+	KSU_PRCTL(CMD_GET_VERSION, "get_version",
+		  KSU_PERM_ROOT | KSU_PERM_MANAGER, prctl_get_version),
+	KSU_PRCTL(CMD_GET_ALLOW_LIST, "get_allow_list",
+		  KSU_PERM_ROOT | KSU_PERM_MANAGER, prctl_get_allow_list),
+	KSU_PRCTL(CMD_GET_DENY_LIST, "get_deny_list",
+		  KSU_PERM_ROOT | KSU_PERM_MANAGER, prctl_get_deny_list),
+	KSU_PRCTL(CMD_REPORT_EVENT, "report_event", KSU_PERM_ROOT,
+		  prctl_report_event),
+	KSU_PRCTL(CMD_SET_SEPOLICY, "set_sepolicy", KSU_PERM_ROOT,
+		  prctl_set_sepolicy),
+	KSU_PRCTL(CMD_CHECK_SAFEMODE, "check_safemode",
+		  KSU_PERM_ROOT | KSU_PERM_MANAGER, prctl_check_safemode),
+	KSU_PRCTL(CMD_GET_APP_PROFILE, "get_app_profile", KSU_PERM_MANAGER,
+		  prctl_get_app_profile),
+	KSU_PRCTL(CMD_SET_APP_PROFILE, "set_app_profile", KSU_PERM_MANAGER,
+		  prctl_set_app_profile),
+	KSU_PRCTL(CMD_UID_GRANTED_ROOT, "uid_granted_root",
+		  KSU_PERM_ROOT | KSU_PERM_MANAGER, prctl_uid_granted_root),
+	KSU_PRCTL(CMD_UID_SHOULD_UMOUNT, "uid_should_umount",
+		  KSU_PERM_ROOT | KSU_PERM_MANAGER, prctl_uid_should_umount),
+	KSU_PRCTL(CMD_GET_APP_PROFILES, "get_app_profiles", KSU_PERM_MANAGER,
+		  prctl_get_app_profiles),
+	KSU_PRCTL(CMD_SET_APP_PROFILES, "set_app_profiles", KSU_PERM_MANAGER,
+		  prctl_set_app_profiles),
+	KSU_PRCTL(CMD_GET_ALLOW_LIST_PAGED, "get_allow_list_paged",
+		  KSU_PERM_ROOT | KSU_PERM_MANAGER, prctl_get_allow_list_paged),
+	KSU_PRCTL(CMD_GET_ALLOW_LIST_NOTIFY_FD, "get_allow_list_notify_fd",
+		  KSU_PERM_ROOT | KSU_PERM_MANAGER,
+		  prctl_get_allow_list_notify_fd),
+	KSU_PRCTL(CMD_GET_APP_PROFILE_TLV, "get_app_profile_tlv",
+		  KSU_PERM_MANAGER, prctl_get_app_profile_tlv),
+	KSU_PRCTL(CMD_SET_APP_PROFILE_TLV, "set_app_profile_tlv",
+		  KSU_PERM_MANAGER, prctl_set_app_profile_tlv),
+	KSU_PRCTL(CMD_SET_ROOT_PROFILE_TEMPLATE, "set_root_profile_template",
+		  KSU_PERM_ROOT | KSU_PERM_MANAGER,
+		  prctl_set_root_profile_template),
+	KSU_PRCTL(CMD_GET_CONTROL_FD, "get_control_fd",
+		  KSU_PERM_ROOT | KSU_PERM_MANAGER, prctl_get_control_fd),
+	KSU_PRCTL(CMD_ADD_TRY_UMOUNT, "add_try_umount", KSU_PERM_ROOT,
+		  prctl_add_try_umount),
+	KSU_PRCTL(CMD_ENABLE_SU, "enable_su", KSU_PERM_ROOT, prctl_enable_su),
+	KSU_PRCTL(CMD_IS_SU_ENABLED, "is_su_enabled",
+		  KSU_PERM_ROOT | KSU_PERM_MANAGER, prctl_is_su_enabled),
+};
+
+const char *ksu_prctl_cmd_name(unsigned long cmd)
+{
+	if (cmd >= ARRAY_SIZE(ksu_prctl_cmds)) {
+		return NULL;
+	}
+	return ksu_prctl_cmds[cmd].name;
+}
+
+static bool prctl_permitted(u32 perm)
+{
+	if (perm == KSU_PERM_ANY) {
+		return true;
+	}
+	if ((perm & KSU_PERM_ROOT) && 0 == current_uid().val) {
+		return true;
+	}
+	return (perm & KSU_PERM_MANAGER) && is_manager();
+}
+
+// every prctl of the system comes here, let the others go with one compare
+static __always_inline bool is_ksu_prctl_option(int option)
+{
+	return unlikely((u32)option - KERNEL_SU_OPTION <= KSU_HACK_OPTION_MAX);
+}
+
+int ksu_handle_prctl(int option, unsigned long arg2, unsigned long arg3,
+		     unsigned long arg4, unsigned long arg5)
+{
+	const struct ksu_prctl_cmd *cmd;
+	u64 start = 0;
+	bool success;
+
+	if (!is_ksu_prctl_option(option)) {
+		ksu_prctl_account(false);
+		return 0;
+	}
+	ksu_prctl_account(true);
+
+	if (KERNEL_SU_OPTION != option) {
+		return hack_handle_prctl(option, arg2, arg3, arg4, arg5);
+	}
+
+	// always ignore isolated app uid
+	if (is_isolated_uid(current_uid().val)) {
+		return 0;
+	}
+
+	if (ksu_uid_throttled(current_uid().val)) {
+		return 0;
+	}
+
+#ifdef CONFIG_KSU_DEBUG
+	pr_info("option: 0x%x, cmd: %ld\n", option, arg2);
+#endif
+
+	if (arg2 >= ARRAY_SIZE(ksu_prctl_cmds) ||
+	    !ksu_prctl_cmds[arg2].handler) {
+		return 0;
+	}
+	cmd = &ksu_prctl_cmds[arg2];
+
+	if (!prctl_permitted(cmd->perm)) {
+		// manager only cmds are probed by nobody else
+		if (cmd->perm == KSU_PERM_MANAGER) {
+			block_current_uid();
+		}
+		ksu_prctl_cmd_account(arg2, KSU_PRCTL_DENIED, 0);
+		return 0;
+	}
+
+	if (ksu_prctl_cmd_stats_enabled()) {
+		start = ktime_get_ns();
+	}
+
+	success = cmd->handler(arg3, arg4);
+	if (success && arg5) {
+		// if success, we modify the arg5 as result!
+		u32 reply_ok = KERNEL_SU_OPTION;
+		if (copy_to_user((u32 __user *)arg5, &reply_ok,
+				 sizeof(reply_ok))) {
+			pr_err("prctl reply error, cmd: %lu\n", arg2);
+		}
 	}
 
-	ksu_umount_mnt(&path, flags);
+	if (start) {
+		ksu_prctl_cmd_account(arg2,
+				      success ? KSU_PRCTL_OK : KSU_PRCTL_FAILED,
+				      ktime_get_ns() - start);
+	}
+
+	return 0;
+}
+
+static bool is_appuid(kuid_t uid)
+{
+#define PER_USER_RANGE 100000
+#define FIRST_APPLICATION_UID 10000
+#define LAST_APPLICATION_UID 19999
+
+	uid_t appid = uid.val % PER_USER_RANGE;
+	return appid >= FIRST_APPLICATION_UID && appid <= LAST_APPLICATION_UID;
 }
 
 int ksu_handle_setuid(struct cred *new, const struct cred *old)
@@ -1018,11 +1427,8 @@ int ksu_handle_setuid(struct cred *new, const struct cred *old)
 		return 0;
 	}
 
-	if (ksu_is_allow_uid(new_uid.val)) {
-		// pr_info("handle setuid ignore allowed application: %d\n", new_uid.val);
-		return 0;
-	}
-
+	// allowed applications are never umounted, this is covered by the
+	// precomputed verdict so that we don't need to check it separately.
 	if (!ksu_uid_should_umount(new_uid.val)) {
 		return 0;
 	} else {
@@ -1044,16 +1450,7 @@ int ksu_handle_setuid(struct cred *new, const struct cred *old)
 	pr_info("handle umount for uid: %d, pid: %d\n", new_uid.val,
 		current->pid);
 
-	// fixme: use `collect_mounts` and `iterate_mount` to iterate all mountpoint and
-	// filter the mountpoint whose target is `/data/adb`
-	try_umount("/system", true, 0);
-	try_umount("/vendor", true, 0);
-	try_umount("/product", true, 0);
-	try_umount("/data/adb/modules", false, MNT_DETACH);
-
-	// try umount ksu temp path
-	try_umount("/debug_ramdisk", false, MNT_DETACH);
-	try_umount("/sbin", false, MNT_DETACH);
+	ksu_umount_modules(old, new_uid.val);
 
 	return 0;
 }
@@ -1068,17 +1465,25 @@ static int handler_pre(struct kprobe *p, struct pt_regs *regs)
 	struct pt_regs *real_regs = regs;
 #endif
 	int option = (int)PT_REGS_PARM1(real_regs);
-	unsigned long arg2 = (unsigned long)PT_REGS_PARM2(real_regs);
-	unsigned long arg3 = (unsigned long)PT_REGS_PARM3(real_regs);
+	unsigned long arg2, arg3, arg4, arg5;
+
+	// don't unpack the rest for PR_SET_NAME, PR_SET_VMA and friends
+	if (!is_ksu_prctl_option(option)) {
+		ksu_prctl_account(false);
+		return 0;
+	}
+
+	arg2 = (unsigned long)PT_REGS_PARM2(real_regs);
+	arg3 = (unsigned long)PT_REGS_PARM3(real_regs);
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 16, 0)
 	// PRCTL_SYMBOL is the arch-specificed one, which receive raw pt_regs from syscall
-	unsigned long arg4 = (unsigned long)PT_REGS_SYSCALL_PARM4(real_regs);
+	arg4 = (unsigned long)PT_REGS_SYSCALL_PARM4(real_regs);
 #else
 	// PRCTL_SYMBOL is the common one, called by C convention in do_syscall_64
 	// https://elixir.bootlin.com/linux/v4.15.18/source/arch/x86/entry/common.c#L287
-	unsigned long arg4 = (unsigned long)PT_REGS_CCALL_PARM4(real_regs);
+	arg4 = (unsigned long)PT_REGS_CCALL_PARM4(real_regs);
 #endif
-	unsigned long arg5 = (unsigned long)PT_REGS_PARM5(real_regs);
+	arg5 = (unsigned long)PT_REGS_PARM5(real_regs);
 
 	return ksu_handle_prctl(option, arg2, arg3, arg4, arg5);
 }
@@ -1,9 +1,39 @@
 #ifndef __KSU_H_KSU_CORE
 #define __KSU_H_KSU_CORE
 
+#include "linux/cred.h"
 #include "linux/init.h"
+#include "linux/types.h"
+
+#include "ksu.h"
 
 void __init ksu_core_init(void);
 void ksu_core_exit(void);
 
+// the prctl and ioctl interfaces always ignore them
+static inline bool is_isolated_uid(uid_t uid)
+{
+#define FIRST_ISOLATED_UID 99000
+#define LAST_ISOLATED_UID 99999
+#define FIRST_APP_ZYGOTE_ISOLATED_UID 90000
+#define LAST_APP_ZYGOTE_ISOLATED_UID 98999
+	uid_t appid = uid % 100000;
+	return (appid >= FIRST_ISOLATED_UID && appid <= LAST_ISOLATED_UID) ||
+	       (appid >= FIRST_APP_ZYGOTE_ISOLATED_UID &&
+		appid <= LAST_APP_ZYGOTE_ISOLATED_UID);
+}
+
+void escape_to_root(void);
+
+// returns the sorted supplementary groups of the profile, NULL on failure
+struct group_info *ksu_alloc_root_groups(const struct root_profile *profile,
+					 struct user_namespace *ns);
+
+void ksu_report_event(unsigned long event);
+
+// shared by the prctl and ioctl interfaces, the user pointers are in the args
+bool ksu_handle_get_app_profiles(struct app_profile_batch *batch);
+bool ksu_handle_set_app_profiles(struct app_profile_batch *batch);
+bool ksu_handle_get_allow_list_page(struct allow_list_page *page);
+
 #endif
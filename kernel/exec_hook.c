@@ -0,0 +1,157 @@
+#include "linux/err.h"
+#include "linux/fs.h"
+#include "linux/kprobes.h"
+#include "linux/mutex.h"
+#include "linux/string.h"
+#include "linux/types.h"
+#include "linux/version.h"
+
+#include "arch.h"
+#include "exec_hook.h"
+#include "klog.h" // IWYU pragma: keep
+#include "ksud.h"
+#include "sucompat.h"
+
+// all the names but /init share it, so it is compared only once
+#define SYSTEM_BIN "/system/bin/"
+#define SYSTEM_BIN_LEN (sizeof(SYSTEM_BIN) - 1)
+
+struct exec_name {
+	int match;
+	// bytes to compare, the NUL is included if it is not a prefix
+	size_t len;
+	const char *name;
+};
+
+#define EXEC_PREFIX(m, s) { .match = m, .len = sizeof(s) - 1, .name = s }
+#define EXEC_EXACT(m, s) { .match = m, .len = sizeof(s), .name = s }
+
+// the names under SYSTEM_BIN
+static const struct exec_name system_bin_names[] = {
+	EXEC_EXACT(KSU_EXEC_SU, "su"),
+	EXEC_PREFIX(KSU_EXEC_INIT, "init"),
+	EXEC_PREFIX(KSU_EXEC_APP_PROCESS, "app_process"),
+};
+
+static const struct exec_name old_init = EXEC_PREFIX(KSU_EXEC_OLD_INIT,
+						     "/init");
+
+int ksu_exec_match(struct filename **filename_ptr)
+{
+	const char *name;
+	int i;
+
+	if (unlikely(!filename_ptr) || IS_ERR(*filename_ptr))
+		return KSU_EXEC_OTHER;
+
+	name = (*filename_ptr)->name;
+	if (memcmp(name, SYSTEM_BIN, SYSTEM_BIN_LEN)) {
+		if (unlikely(!memcmp(name, old_init.name, old_init.len)))
+			return old_init.match;
+		return KSU_EXEC_OTHER;
+	}
+
+	name += SYSTEM_BIN_LEN;
+	for (i = 0; i < ARRAY_SIZE(system_bin_names); i++) {
+		const struct exec_name *e = &system_bin_names[i];
+
+		if (!memcmp(name, e->name, e->len))
+			return e->match;
+	}
+
+	return KSU_EXEC_OTHER;
+}
+
+// for the manually patched exec, ksud decides if it is still needed itself
+int ksu_handle_execveat(int *fd, struct filename **filename_ptr, void *argv,
+			void *envp, int *flags)
+{
+	int match = ksu_exec_match(filename_ptr);
+
+	__ksu_handle_execveat_ksud(match, argv, envp);
+	return __ksu_handle_execveat_sucompat(match, filename_ptr);
+}
+
+#ifdef CONFIG_KPROBES
+
+static DEFINE_MUTEX(exec_hook_mutex);
+// KSU_EXEC_HOOK_* of the users, the kprobe is registered if it is not 0
+static unsigned int exec_hook_users;
+
+// https://elixir.bootlin.com/linux/v5.10.158/source/fs/exec.c#L1864
+static int execve_handler_pre(struct kprobe *p, struct pt_regs *regs)
+{
+	struct filename **filename_ptr =
+		(struct filename **)&PT_REGS_PARM2(regs);
+	unsigned int users = READ_ONCE(exec_hook_users);
+	int match = ksu_exec_match(filename_ptr);
+
+	if (unlikely(users & KSU_EXEC_HOOK_KSUD)) {
+		struct user_arg_ptr argv;
+#ifdef CONFIG_COMPAT
+		argv.is_compat = PT_REGS_PARM3(regs);
+		if (unlikely(argv.is_compat)) {
+			argv.ptr.compat = PT_REGS_CCALL_PARM4(regs);
+		} else {
+			argv.ptr.native = PT_REGS_CCALL_PARM4(regs);
+		}
+#else
+		argv.ptr.native = PT_REGS_PARM3(regs);
+#endif
+		__ksu_handle_execveat_ksud(match, &argv, NULL);
+	}
+
+	if (users & KSU_EXEC_HOOK_SUCOMPAT)
+		__ksu_handle_execveat_sucompat(match, filename_ptr);
+
+	return 0;
+}
+
+static struct kprobe execve_kp = {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 9, 0)
+	.symbol_name = "do_execveat_common",
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(4, 19, 0)
+	.symbol_name = "__do_execve_file",
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(3, 19, 0)
+	.symbol_name = "do_execveat_common",
+#endif
+	.pre_handler = execve_handler_pre,
+};
+
+int ksu_exec_hook_get(unsigned int user)
+{
+	int ret = 0;
+
+	mutex_lock(&exec_hook_mutex);
+	if (!exec_hook_users) {
+		// a kprobe keeps the resolved address, which fails registering
+		// it again
+		execve_kp.addr = NULL;
+		execve_kp.flags = 0;
+		ret = register_kprobe(&execve_kp);
+		if (ret)
+			goto out;
+	}
+	WRITE_ONCE(exec_hook_users, exec_hook_users | user);
+out:
+	mutex_unlock(&exec_hook_mutex);
+
+	return ret;
+}
+
+void ksu_exec_hook_put(unsigned int user)
+{
+	mutex_lock(&exec_hook_mutex);
+	if (!(exec_hook_users & user))
+		goto out;
+
+	WRITE_ONCE(exec_hook_users, exec_hook_users & ~user);
+	if (!exec_hook_users) {
+		unregister_kprobe(&execve_kp);
+		pr_info("exec hook: unregistered\n");
+	}
+out:
+	mutex_unlock(&exec_hook_mutex);
+}
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef __KSU_H_EXEC_HOOK
+#define __KSU_H_EXEC_HOOK
+
+#include "linux/fs.h"
+#include "linux/types.h"
+
+// the executables the exec handlers look for, by ksu_exec_match
+#define KSU_EXEC_OTHER 0
+#define KSU_EXEC_SU 1 // /system/bin/su
+#define KSU_EXEC_INIT 2 // /system/bin/init*
+#define KSU_EXEC_APP_PROCESS 3 // /system/bin/app_process*
+#define KSU_EXEC_OLD_INIT 4 // /init*
+
+/*
+ * Match the name of the file executed once for all the handlers, so they
+ * compare an int instead of the names. KSU_EXEC_OTHER if filename_ptr is not
+ * a valid filename.
+ */
+int ksu_exec_match(struct filename **filename_ptr);
+
+// users of the exec kprobe
+#define KSU_EXEC_HOOK_KSUD (1 << 0) // the boot handler of ksud
+#define KSU_EXEC_HOOK_SUCOMPAT (1 << 1)
+
+/*
+ * A single kprobe on the exec entry calls the handlers of all its users, it is
+ * registered with the first user and unregistered with the last one. They may
+ * sleep, so they can't be called from a kprobe.
+ */
+int ksu_exec_hook_get(unsigned int user);
+void ksu_exec_hook_put(unsigned int user);
+
+#endif
@@ -13,6 +13,29 @@ extern long ksu_strncpy_from_user_nofault(char *dst,
 extern struct key *init_session_keyring;
 #endif
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 16, 0)
+typedef unsigned int __poll_t;
+#define EPOLLIN POLLIN
+#define EPOLLRDNORM POLLRDNORM
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 7, 0)
+// task_work_add takes a bool notify before 5.7
+#define TWA_RESUME true
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 8, 0)
+// the mmap locking API of 5.8
+#define mmap_read_trylock(mm) down_read_trylock(&(mm)->mmap_sem)
+#define mmap_read_unlock(mm) up_read(&(mm)->mmap_sem)
+#define mmap_write_unlock(mm) up_write(&(mm)->mmap_sem)
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 7, 0)
+#define mmap_write_lock_killable(mm) down_write_killable(&(mm)->mmap_sem)
+#else
+#define mmap_write_lock_killable(mm) (down_write(&(mm)->mmap_sem), 0)
+#endif
+#endif
+
 extern void ksu_android_ns_fs_check();
 extern struct file *ksu_filp_open_compat(const char *filename, int flags,
 					 umode_t mode);
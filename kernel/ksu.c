@@ -7,7 +7,12 @@
 #include "core_hook.h"
 #include "klog.h" // IWYU pragma: keep
 #include "ksu.h"
+#include "path_page.h"
+#include "prctl_stats.h"
+#include "sucompat.h"
+#include "sucompat_stats.h"
 #include "uid_observer.h"
+#include "umount.h"
 
 static struct workqueue_struct *ksu_workqueue;
 
@@ -16,21 +21,11 @@ bool ksu_queue_work(struct work_struct *work)
 	return queue_work(ksu_workqueue, work);
 }
 
-extern int ksu_handle_execveat_sucompat(int *fd, struct filename **filename_ptr,
-					void *argv, void *envp, int *flags);
-
-extern int ksu_handle_execveat_ksud(int *fd, struct filename **filename_ptr,
-				    void *argv, void *envp, int *flags);
-
-int ksu_handle_execveat(int *fd, struct filename **filename_ptr, void *argv,
-			void *envp, int *flags)
+bool ksu_queue_delayed_work(struct delayed_work *work, unsigned long delay)
 {
-	ksu_handle_execveat_ksud(fd, filename_ptr, argv, envp, flags);
-	return ksu_handle_execveat_sucompat(fd, filename_ptr, argv, envp,
-					    flags);
+	return queue_delayed_work(ksu_workqueue, work, delay);
 }
 
-extern void ksu_enable_sucompat();
 extern void ksu_enable_ksud();
 
 int __init kernelsu_init(void)
@@ -45,6 +40,10 @@ int __init kernelsu_init(void)
 	pr_alert("*************************************************************");
 #endif
 
+	ksu_prctl_stats_init();
+
+	ksu_sucompat_stats_init();
+
 	ksu_core_init();
 
 	ksu_workqueue = alloc_ordered_workqueue("kernelsu_work_queue", 0);
@@ -53,8 +52,10 @@ int __init kernelsu_init(void)
 
 	ksu_uid_observer_init();
 
-#ifdef CONFIG_KPROBES
+	ksu_path_page_init();
+
 	ksu_enable_sucompat();
+#ifdef CONFIG_KPROBES
 	ksu_enable_ksud();
 #else
 	pr_alert("KPROBES is disabled, KernelSU may not work, please check https://kernelsu.org/guide/how-to-integrate-for-non-gki.html");
@@ -72,6 +73,14 @@ void kernelsu_exit(void)
 	destroy_workqueue(ksu_workqueue);
 
 	ksu_core_exit();
+
+	ksu_disable_sucompat();
+
+	ksu_umount_exit();
+
+	ksu_prctl_stats_exit();
+
+	ksu_sucompat_stats_exit();
 }
 
 module_init(kernelsu_init);
@@ -1,6 +1,7 @@
 #ifndef __KSU_H_KSU
 #define __KSU_H_KSU
 
+#include "linux/ioctl.h"
 #include "linux/types.h"
 #include "linux/workqueue.h"
 
@@ -21,6 +22,24 @@
 #define CMD_SET_APP_PROFILE 11
 #define CMD_UID_GRANTED_ROOT 12
 #define CMD_UID_SHOULD_UMOUNT 13
+#define CMD_GET_APP_PROFILES 14
+#define CMD_SET_APP_PROFILES 15
+#define CMD_GET_ALLOW_LIST_PAGED 16
+#define CMD_GET_ALLOW_LIST_NOTIFY_FD 17
+// like CMD_GET/SET_APP_PROFILE, but the profile is encoded by profile_tlv.h
+#define CMD_GET_APP_PROFILE_TLV 18
+#define CMD_SET_APP_PROFILE_TLV 19
+#define CMD_SET_ROOT_PROFILE_TEMPLATE 20
+// returns a fd taking the KSU_IOCTL_* commands below
+#define CMD_GET_CONTROL_FD 21
+// arg3: path of a mount made for modules, NULL to clear them; arg4: umount flags
+#define CMD_ADD_TRY_UMOUNT 22
+// arg3: 0 to unregister the su compatibility hooks, otherwise register them
+#define CMD_ENABLE_SU 23
+// arg3: user pointer to a bool, set if the su compatibility hooks are in place
+#define CMD_IS_SU_ENABLED 24
+// size of the command table, keep it the last one + 1
+#define KSU_PRCTL_CMD_COUNT 25
 
 #define EVENT_POST_FS_DATA 1
 #define EVENT_BOOT_COMPLETED 2
@@ -51,8 +70,15 @@ struct root_profile {
 	int32_t namespaces;
 };
 
+#define KSU_MAX_UMOUNT_PATHS 4
+#define KSU_UMOUNT_PATH_MAX 64
+
 struct non_root_profile {
 	bool umount_modules;
+	// umount only the mounts at or under these paths, or all the mounts made
+	// for modules if it is 0. The kernel keeps them sorted.
+	u8 umount_paths_count;
+	char umount_paths[KSU_MAX_UMOUNT_PATHS][KSU_UMOUNT_PATH_MAX];
 };
 
 struct app_profile {
@@ -80,8 +106,98 @@ struct app_profile {
 	};
 };
 
+// argument of CMD_SET_ROOT_PROFILE_TEMPLATE
+struct root_profile_template {
+	// the template_name referenced by app profiles
+	char name[KSU_MAX_PACKAGE_NAME];
+	struct root_profile profile;
+};
+
+// argument of CMD_GET_APP_PROFILES and CMD_SET_APP_PROFILES
+struct app_profile_batch {
+	// get: index of the first profile to return, updated to where the next
+	// call should continue from, 0 means there are no more profiles.
+	u32 cursor;
+	// in: capacity of profiles, out: number of profiles got or set
+	u32 count;
+	// user pointer to struct app_profile[count]
+	u64 profiles;
+};
+
+// argument of CMD_GET_ALLOW_LIST_PAGED
+struct allow_list_page {
+	// in: generation of the list the caller has, out: current generation.
+	// The caller should restart from cursor 0 if it changed between pages.
+	u32 generation;
+	// index to start from, updated to where the next call should continue
+	// from, 0 means there are no more uids.
+	u32 cursor;
+	// in: capacity of uids, out: number of uids filled
+	u32 count;
+	// get the uids allowed to su if non zero, otherwise the denied ones
+	u32 allow;
+	// user pointer to u32[count]
+	u64 uids;
+};
+
+/*
+ * ioctl commands of the fd from CMD_GET_CONTROL_FD. The permission of the
+ * caller is checked for each command, they return 0 or a negative errno.
+ * New commands must be added with a new number, never change the existing ones.
+ */
+#define KSU_CONTROL_ABI_VERSION 1
+
+#define KSU_INFO_MANAGER (1 << 0) // the caller is the manager
+#define KSU_INFO_SAFE_MODE (1 << 1)
+
+struct ksu_control_info {
+	u32 abi_version;
+	u32 version;
+	u32 flags;
+};
+
+#define KSU_UID_GRANTED_ROOT (1 << 0)
+#define KSU_UID_SHOULD_UMOUNT (1 << 1)
+
+struct ksu_uid_status {
+	// in
+	u32 uid;
+	// out: KSU_UID_*
+	u32 flags;
+};
+
+struct ksu_sepolicy_cmd {
+	u64 cmd;
+	// user pointer to the policy data
+	u64 arg;
+};
+
+#define KSU_IOCTL_MAGIC 'K'
+
+#define KSU_IOCTL_GET_INFO _IOR(KSU_IOCTL_MAGIC, 1, struct ksu_control_info)
+#define KSU_IOCTL_GRANT_ROOT _IO(KSU_IOCTL_MAGIC, 2)
+#define KSU_IOCTL_REPORT_EVENT _IOW(KSU_IOCTL_MAGIC, 3, u32)
+#define KSU_IOCTL_SET_SEPOLICY _IOW(KSU_IOCTL_MAGIC, 4, struct ksu_sepolicy_cmd)
+#define KSU_IOCTL_GET_UID_STATUS _IOWR(KSU_IOCTL_MAGIC, 5, struct ksu_uid_status)
+#define KSU_IOCTL_GET_ALLOW_LIST _IOWR(KSU_IOCTL_MAGIC, 6, struct allow_list_page)
+// returns the fd, like CMD_GET_ALLOW_LIST_NOTIFY_FD
+#define KSU_IOCTL_GET_ALLOW_LIST_NOTIFY_FD _IO(KSU_IOCTL_MAGIC, 7)
+// -ENOENT if there is no such profile
+#define KSU_IOCTL_GET_APP_PROFILE _IOWR(KSU_IOCTL_MAGIC, 8, struct app_profile)
+#define KSU_IOCTL_SET_APP_PROFILE _IOW(KSU_IOCTL_MAGIC, 9, struct app_profile)
+#define KSU_IOCTL_GET_APP_PROFILES \
+	_IOWR(KSU_IOCTL_MAGIC, 10, struct app_profile_batch)
+#define KSU_IOCTL_SET_APP_PROFILES \
+	_IOWR(KSU_IOCTL_MAGIC, 11, struct app_profile_batch)
+#define KSU_IOCTL_SET_ROOT_PROFILE_TEMPLATE \
+	_IOW(KSU_IOCTL_MAGIC, 12, struct root_profile_template)
+// size of the ioctl table, keep it the last number + 1
+#define KSU_IOCTL_CMD_COUNT 13
+
 bool ksu_queue_work(struct work_struct *work);
 
+bool ksu_queue_delayed_work(struct delayed_work *work, unsigned long delay);
+
 static inline int startswith(char *s, char *prefix)
 {
 	return strncmp(s, prefix, strlen(prefix));
@@ -0,0 +1,82 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM ksu
+
+#if !defined(__KSU_H_TRACE) || defined(TRACE_HEADER_MULTI_READ)
+#define __KSU_H_TRACE
+
+#include "linux/tracepoint.h"
+
+#include "sucompat_stats.h"
+
+// time an app launch spent in unmounting modules
+TRACE_EVENT(ksu_umount_modules,
+
+	TP_PROTO(uid_t uid, pid_t pid, int count, u64 duration_ns,
+		 bool deferred),
+
+	TP_ARGS(uid, pid, count, duration_ns, deferred),
+
+	TP_STRUCT__entry(
+		__field(uid_t, uid)
+		__field(pid_t, pid)
+		__field(int, count)
+		__field(u64, duration_ns)
+		__field(bool, deferred)
+	),
+
+	TP_fast_assign(
+		__entry->uid = uid;
+		__entry->pid = pid;
+		__entry->count = count;
+		__entry->duration_ns = duration_ns;
+		__entry->deferred = deferred;
+	),
+
+	TP_printk("uid=%u pid=%d count=%d duration_ns=%llu deferred=%d",
+		  __entry->uid, __entry->pid, __entry->count,
+		  __entry->duration_ns, __entry->deferred)
+);
+
+// a hit of the su compatibility hooks, see sucompat_stats.h for the values
+TRACE_EVENT(ksu_sucompat,
+
+	TP_PROTO(int hook, uid_t uid, int result, u64 copy_ns),
+
+	TP_ARGS(hook, uid, result, copy_ns),
+
+	TP_STRUCT__entry(
+		__field(int, hook)
+		__field(uid_t, uid)
+		__field(int, result)
+		__field(u64, copy_ns)
+	),
+
+	TP_fast_assign(
+		__entry->hook = hook;
+		__entry->uid = uid;
+		__entry->result = result;
+		__entry->copy_ns = copy_ns;
+	),
+
+	TP_printk("hook=%s uid=%u result=%s copy_ns=%llu",
+		  __print_symbolic(__entry->hook,
+				   { KSU_SUCOMPAT_EXECVE, "execve" },
+				   { KSU_SUCOMPAT_FACCESSAT, "faccessat" },
+				   { KSU_SUCOMPAT_STAT, "stat" }),
+		  __entry->uid,
+		  __print_symbolic(__entry->result,
+				   { KSU_SUCOMPAT_PASS, "pass" },
+				   { KSU_SUCOMPAT_MISS, "miss" },
+				   { KSU_SUCOMPAT_REWRITE, "rewrite" }),
+		  __entry->copy_ns)
+);
+
+#endif
+
+// the header is not in include/trace/events
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE ksu_trace
+
+#include <trace/define_trace.h>
@@ -1,8 +1,28 @@
 #ifndef __KSU_H_KSUD
 #define __KSU_H_KSUD
 
+#include "linux/compat.h"
+#include "linux/types.h"
+
 #define KSUD_PATH "/data/adb/ksud"
 
+// the argv or envp of an exec, like the one in fs/exec.c
+struct user_arg_ptr {
+#ifdef CONFIG_COMPAT
+	bool is_compat;
+#endif
+	union {
+		const char __user *const __user *native;
+#ifdef CONFIG_COMPAT
+		const compat_uptr_t __user *compat;
+#endif
+	} ptr;
+};
+
+// the boot handler of exec, match is the KSU_EXEC_* of the file executed
+int __ksu_handle_execveat_ksud(int match, struct user_arg_ptr *argv,
+			       struct user_arg_ptr *envp);
+
 void on_post_fs_data(void);
 
 bool ksu_is_safe_mode(void);
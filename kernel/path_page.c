@@ -0,0 +1,241 @@
+#include "linux/err.h"
+#include "linux/gfp.h"
+#include "linux/hash.h"
+#include "linux/kernel.h"
+#include "linux/mm.h"
+#include "linux/sched.h"
+#include "linux/slab.h"
+#include "linux/spinlock.h"
+#include "linux/string.h"
+#include "linux/task_work.h"
+#include "linux/types.h"
+#include "linux/version.h"
+
+#include "kernel_compat.h"
+#include "klog.h" // IWYU pragma: keep
+#include "path_page.h"
+
+#ifndef MODULE
+
+#define PATH_PAGE_SET_BITS 6
+#define PATH_PAGE_WAYS 4
+
+// the page is shared by all the processes, it is never freed once mapped
+static struct page *path_pages[1];
+
+static struct vm_special_mapping path_mapping = {
+	.name = "[ksu_paths]",
+	.pages = path_pages,
+};
+
+/*
+ * The address of the entry of a mm whose page is being mapped or failed to be
+ * mapped, so it is tried only once per mm and the stack copy is used then.
+ * A page is never mapped at it since it is not page aligned.
+ */
+#define PATH_PAGE_REQUESTED 1UL
+
+// where the page is mapped in a mm, it may be gone, so check it before use
+struct path_page_entry {
+	struct mm_struct *mm;
+	unsigned long addr; // or PATH_PAGE_REQUESTED
+};
+
+static struct path_page_entry path_page_table[(1 << PATH_PAGE_SET_BITS) *
+					      PATH_PAGE_WAYS];
+static unsigned int path_page_victim;
+static DEFINE_SPINLOCK(path_page_lock);
+
+static struct path_page_entry *path_page_set(struct mm_struct *mm)
+{
+	return &path_page_table[hash_ptr(mm, PATH_PAGE_SET_BITS) *
+				PATH_PAGE_WAYS];
+}
+
+// 0 if there is no entry for mm
+static unsigned long lookup_addr(struct mm_struct *mm)
+{
+	struct path_page_entry *set = path_page_set(mm);
+	unsigned long addr = 0;
+	int i;
+
+	spin_lock(&path_page_lock);
+	for (i = 0; i < PATH_PAGE_WAYS; i++) {
+		if (set[i].mm == mm) {
+			addr = set[i].addr;
+			break;
+		}
+	}
+	spin_unlock(&path_page_lock);
+
+	return addr;
+}
+
+static void remember_addr(struct mm_struct *mm, unsigned long addr)
+{
+	struct path_page_entry *set = path_page_set(mm);
+	struct path_page_entry *e = NULL;
+	int i;
+
+	spin_lock(&path_page_lock);
+	for (i = 0; i < PATH_PAGE_WAYS; i++) {
+		if (set[i].mm == mm || !set[i].mm) {
+			e = &set[i];
+			break;
+		}
+	}
+	if (!e) {
+		// the mms of the processes gone are never removed, just reuse
+		// the entries in turn
+		e = &set[path_page_victim++ % PATH_PAGE_WAYS];
+	}
+	e->mm = mm;
+	e->addr = addr;
+	spin_unlock(&path_page_lock);
+}
+
+// the mm may be freed and reused, or the page unmapped by the process
+static bool addr_mapped(struct mm_struct *mm, unsigned long addr, bool *locked)
+{
+	struct vm_area_struct *vma;
+	bool mapped;
+
+	*locked = mmap_read_trylock(mm);
+	if (!*locked)
+		return false;
+
+	vma = find_vma(mm, addr);
+	mapped = vma && vma->vm_start == addr &&
+		 vma->vm_private_data == &path_mapping;
+	mmap_read_unlock(mm);
+
+	return mapped;
+}
+
+// must be called with the mmap lock held
+static unsigned long find_path_page(struct mm_struct *mm)
+{
+	struct vm_area_struct *vma;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 1, 0)
+	VMA_ITERATOR(vmi, mm, 0);
+
+	for_each_vma (vmi, vma) {
+#else
+	for (vma = mm->mmap; vma; vma = vma->vm_next) {
+#endif
+		if (vma->vm_private_data == &path_mapping)
+			return vma->vm_start;
+	}
+
+	return 0;
+}
+
+static void map_path_page(struct callback_head *cb)
+{
+	struct mm_struct *mm = current->mm;
+	struct vm_area_struct *vma;
+	unsigned long addr;
+
+	kfree(cb);
+
+	if (!mm || mmap_write_lock_killable(mm))
+		return;
+
+	// mapped by another thread, or inherited from the parent by fork. The
+	// entry stays PATH_PAGE_REQUESTED if it fails, it is not tried again.
+	addr = find_path_page(mm);
+	if (addr)
+		goto out;
+
+	addr = get_unmapped_area(NULL, 0, PAGE_SIZE, 0, 0);
+	if (IS_ERR_VALUE(addr)) {
+		pr_err("path page: no room in mm of pid: %d\n", current->pid);
+		addr = 0;
+		goto out;
+	}
+
+	// without VM_MAYWRITE, it can't be made writable by mprotect
+	vma = _install_special_mapping(mm, addr, PAGE_SIZE, VM_READ | VM_MAYREAD,
+				       &path_mapping);
+	if (IS_ERR(vma)) {
+		pr_err("path page: map failed: %ld\n", PTR_ERR(vma));
+		addr = 0;
+	}
+out:
+	mmap_write_unlock(mm);
+
+	if (addr)
+		remember_addr(mm, addr);
+}
+
+static void request_path_page(void)
+{
+	struct callback_head *cb = kmalloc(sizeof(*cb), GFP_ATOMIC);
+
+	if (!cb)
+		return;
+
+	init_task_work(cb, map_path_page);
+	if (task_work_add(current, cb, TWA_RESUME)) {
+		// we are exiting
+		kfree(cb);
+	}
+}
+
+const char __user *ksu_path_page_user(unsigned int offset)
+{
+	struct mm_struct *mm = current->mm;
+	unsigned long addr;
+	bool locked;
+
+	if (unlikely(!mm || !path_pages[0]))
+		return NULL;
+
+	addr = lookup_addr(mm);
+	if (addr == PATH_PAGE_REQUESTED)
+		return NULL;
+
+	if (addr && addr_mapped(mm, addr, &locked))
+		return (const char __user *)(addr + offset);
+
+	// the mm is busy, it is likely mapped and checked again next time
+	if (addr && !locked)
+		return NULL;
+
+	/*
+	 * Mark it first so that the next hits don't queue another attempt. A new
+	 * mm reusing the address of a failed one keeps the stack copy until its
+	 * entry is reused.
+	 */
+	remember_addr(mm, PATH_PAGE_REQUESTED);
+	request_path_page();
+	return NULL;
+}
+
+void ksu_path_page_init(void)
+{
+	static const char sh[] = "/system/bin/sh";
+	struct page *page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+
+	if (!page) {
+		pr_err("path page: alloc failed\n");
+		return;
+	}
+
+	memcpy(page_address(page) + KSU_PATH_PAGE_SH, sh, sizeof(sh));
+	path_pages[0] = page;
+}
+
+#else
+
+// _install_special_mapping is not exported to the modules
+const char __user *ksu_path_page_user(unsigned int offset)
+{
+	return NULL;
+}
+
+void ksu_path_page_init(void)
+{
+}
+
+#endif
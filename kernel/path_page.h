@@ -0,0 +1,24 @@
+#ifndef __KSU_H_PATH_PAGE
+#define __KSU_H_PATH_PAGE
+
+#include "linux/types.h"
+
+// offsets of the constant paths in the page
+#define KSU_PATH_PAGE_SH 0 // /system/bin/sh
+
+/*
+ * A read only page holding the constant paths sucompat rewrites su to, mapped
+ * into the mm of the process using them, so a rewrite only swaps the user
+ * pointer instead of copying the path to the user memory.
+ *
+ * Returns the address of the path at offset in the page of current->mm, or
+ * NULL if it is not mapped. The first time, the page is then mapped by a
+ * task_work before the task returns to userspace. It is tried once per mm, so
+ * the caller falls back to a copy until then, or for good if it failed.
+ * It doesn't sleep and can be called from a kprobe.
+ */
+const char __user *ksu_path_page_user(unsigned int offset);
+
+void ksu_path_page_init(void);
+
+#endif
@@ -0,0 +1,148 @@
+#include "linux/debugfs.h"
+#include "linux/err.h"
+#include "linux/fs.h"
+#include "linux/kernel.h"
+#include "linux/math64.h"
+#include "linux/mutex.h"
+#include "linux/seq_file.h"
+#include "linux/string.h"
+#include "linux/uaccess.h"
+
+#include "klog.h" // IWYU pragma: keep
+#include "prctl_stats.h"
+
+DEFINE_STATIC_KEY_FALSE(ksu_prctl_stats_key);
+DEFINE_PER_CPU(unsigned long, ksu_prctl_filtered);
+DEFINE_PER_CPU(unsigned long, ksu_prctl_handled);
+DEFINE_PER_CPU(struct ksu_prctl_cmd_stats[KSU_PRCTL_CMD_COUNT],
+	       ksu_prctl_cmd_stats);
+DEFINE_PER_CPU(struct ksu_prctl_cmd_stats[KSU_IOCTL_CMD_COUNT],
+	       ksu_ioctl_cmd_stats);
+
+static DEFINE_MUTEX(stats_mutex);
+struct dentry *ksu_debugfs_dir;
+
+static void show_cmd_stats(struct seq_file *m, unsigned long nr,
+			   const char *name,
+			   struct ksu_prctl_cmd_stats __percpu *pcpu)
+{
+	struct ksu_prctl_cmd_stats sum = { 0 };
+	unsigned long calls;
+	unsigned int i;
+	int cpu;
+
+	for_each_possible_cpu (cpu) {
+		struct ksu_prctl_cmd_stats *stats = per_cpu_ptr(pcpu, cpu);
+		for (i = 0; i < ARRAY_SIZE(sum.calls); i++)
+			sum.calls[i] += stats->calls[i];
+		sum.total_ns += stats->total_ns;
+		sum.max_ns = max(sum.max_ns, stats->max_ns);
+	}
+
+	calls = sum.calls[KSU_PRCTL_OK] + sum.calls[KSU_PRCTL_FAILED];
+	seq_printf(m, "%lu %s %lu %lu %lu %llu %llu\n", nr, name,
+		   sum.calls[KSU_PRCTL_OK], sum.calls[KSU_PRCTL_FAILED],
+		   sum.calls[KSU_PRCTL_DENIED],
+		   calls ? div64_u64(sum.total_ns, calls) : 0, sum.max_ns);
+}
+
+static int prctl_stats_show(struct seq_file *m, void *v)
+{
+	unsigned long filtered = 0, handled = 0;
+	unsigned long cmd;
+	unsigned int nr;
+	int cpu;
+
+	for_each_possible_cpu (cpu) {
+		filtered += per_cpu(ksu_prctl_filtered, cpu);
+		handled += per_cpu(ksu_prctl_handled, cpu);
+	}
+
+	seq_printf(m, "enabled: %d\nfiltered: %lu\nhandled: %lu\n",
+		   static_key_enabled(&ksu_prctl_stats_key), filtered, handled);
+
+	seq_puts(m, "cmd name ok failed denied avg_ns max_ns\n");
+	for (cmd = 0; cmd < KSU_PRCTL_CMD_COUNT; cmd++) {
+		const char *name = ksu_prctl_cmd_name(cmd);
+
+		if (name)
+			show_cmd_stats(m, cmd, name, &ksu_prctl_cmd_stats[cmd]);
+	}
+
+	seq_puts(m, "ioctl name ok failed denied avg_ns max_ns\n");
+	for (nr = 0; nr < KSU_IOCTL_CMD_COUNT; nr++) {
+		const char *name = ksu_ioctl_cmd_name(nr);
+
+		if (name)
+			show_cmd_stats(m, nr, name, &ksu_ioctl_cmd_stats[nr]);
+	}
+
+	return 0;
+}
+
+static int prctl_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, prctl_stats_show, NULL);
+}
+
+// write 1 to reset the counters and start counting, 0 to stop
+static ssize_t prctl_stats_write(struct file *file, const char __user *buf,
+				 size_t count, loff_t *ppos)
+{
+	unsigned int enable;
+	int cpu;
+	int ret;
+
+	ret = kstrtouint_from_user(buf, count, 0, &enable);
+	if (ret)
+		return ret;
+
+	mutex_lock(&stats_mutex);
+	if (enable) {
+		if (!static_key_enabled(&ksu_prctl_stats_key)) {
+			for_each_possible_cpu (cpu) {
+				per_cpu(ksu_prctl_filtered, cpu) = 0;
+				per_cpu(ksu_prctl_handled, cpu) = 0;
+				memset(per_cpu_ptr(&ksu_prctl_cmd_stats, cpu), 0,
+				       sizeof(ksu_prctl_cmd_stats));
+				memset(per_cpu_ptr(&ksu_ioctl_cmd_stats, cpu), 0,
+				       sizeof(ksu_ioctl_cmd_stats));
+			}
+			static_branch_enable(&ksu_prctl_stats_key);
+		}
+	} else {
+		static_branch_disable(&ksu_prctl_stats_key);
+	}
+	mutex_unlock(&stats_mutex);
+
+	return count;
+}
+
+static const struct file_operations prctl_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = prctl_stats_open,
+	.read = seq_read,
+	.write = prctl_stats_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+void ksu_prctl_stats_init(void)
+{
+	ksu_debugfs_dir = debugfs_create_dir("ksu", NULL);
+	if (IS_ERR_OR_NULL(ksu_debugfs_dir)) {
+		// no debugfs, counting just can't be enabled
+		ksu_debugfs_dir = NULL;
+		return;
+	}
+
+	debugfs_create_file("prctl_stats", 0600, ksu_debugfs_dir, NULL,
+			    &prctl_stats_fops);
+}
+
+void ksu_prctl_stats_exit(void)
+{
+	debugfs_remove_recursive(ksu_debugfs_dir);
+	ksu_debugfs_dir = NULL;
+	static_branch_disable(&ksu_prctl_stats_key);
+}
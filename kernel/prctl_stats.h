@@ -0,0 +1,93 @@
+#ifndef __KSU_H_PRCTL_STATS
+#define __KSU_H_PRCTL_STATS
+
+#include "linux/jump_label.h"
+#include "linux/percpu.h"
+#include "linux/types.h"
+
+#include "ksu.h"
+
+DECLARE_STATIC_KEY_FALSE(ksu_prctl_stats_key);
+DECLARE_PER_CPU(unsigned long, ksu_prctl_filtered);
+DECLARE_PER_CPU(unsigned long, ksu_prctl_handled);
+
+/*
+ * Count a prctl filtered out or handled by us. The branch is patched to a nop
+ * unless the counting is enabled in <debugfs>/ksu/prctl_stats.
+ */
+static __always_inline void ksu_prctl_account(bool handled)
+{
+	if (static_branch_unlikely(&ksu_prctl_stats_key)) {
+		if (handled)
+			this_cpu_inc(ksu_prctl_handled);
+		else
+			this_cpu_inc(ksu_prctl_filtered);
+	}
+}
+
+#define KSU_PRCTL_OK 0
+#define KSU_PRCTL_FAILED 1 // the handler didn't reply
+#define KSU_PRCTL_DENIED 2 // the caller is not permitted
+
+struct ksu_prctl_cmd_stats {
+	unsigned long calls[3]; // indexed by KSU_PRCTL_*
+	u64 total_ns; // of the calls reaching the handler
+	u64 max_ns;
+};
+
+DECLARE_PER_CPU(struct ksu_prctl_cmd_stats[KSU_PRCTL_CMD_COUNT],
+		ksu_prctl_cmd_stats);
+
+static __always_inline bool ksu_prctl_cmd_stats_enabled(void)
+{
+	return static_branch_unlikely(&ksu_prctl_stats_key);
+}
+
+DECLARE_PER_CPU(struct ksu_prctl_cmd_stats[KSU_IOCTL_CMD_COUNT],
+		ksu_ioctl_cmd_stats);
+
+static inline void __ksu_cmd_account(struct ksu_prctl_cmd_stats __percpu *pcpu,
+				     int result, u64 ns)
+{
+	struct ksu_prctl_cmd_stats *stats = get_cpu_ptr(pcpu);
+
+	stats->calls[result]++;
+	stats->total_ns += ns;
+	if (ns > stats->max_ns)
+		stats->max_ns = ns;
+	put_cpu_ptr(pcpu);
+}
+
+static inline void ksu_prctl_cmd_account(unsigned long cmd, int result,
+					 u64 ns)
+{
+	if (!ksu_prctl_cmd_stats_enabled() || cmd >= KSU_PRCTL_CMD_COUNT)
+		return;
+
+	__ksu_cmd_account(&ksu_prctl_cmd_stats[cmd], result, ns);
+}
+
+// the control fd commands are counted by _IOC_NR, in the same file
+static inline void ksu_ioctl_cmd_account(unsigned int nr, int result, u64 ns)
+{
+	if (!ksu_prctl_cmd_stats_enabled() || nr >= KSU_IOCTL_CMD_COUNT)
+		return;
+
+	__ksu_cmd_account(&ksu_ioctl_cmd_stats[nr], result, ns);
+}
+
+// NULL if there is no such cmd, defined in core_hook.c
+const char *ksu_prctl_cmd_name(unsigned long cmd);
+// NULL if there is no such nr, defined in control.c
+const char *ksu_ioctl_cmd_name(unsigned int nr);
+
+struct dentry;
+
+// <debugfs>/ksu, NULL if there is no debugfs
+extern struct dentry *ksu_debugfs_dir;
+
+// creates ksu_debugfs_dir, call it before adding any file there
+void ksu_prctl_stats_init(void);
+void ksu_prctl_stats_exit(void);
+
+#endif
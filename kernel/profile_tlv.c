@@ -0,0 +1,283 @@
+#include "linux/errno.h"
+#include "linux/kernel.h"
+#include "linux/string.h"
+#include "linux/types.h"
+
+#include "klog.h" // IWYU pragma: keep
+#include "ksu.h"
+#include "profile_tlv.h"
+
+#define TLV_HEADER_SIZE 3 // u8 tag, u16 length
+
+struct tlv_writer {
+	u8 *buf;
+	size_t size;
+	size_t off;
+	bool overflow;
+};
+
+static void put_tlv(struct tlv_writer *w, u8 tag, const void *value, size_t len)
+{
+	u16 len16 = len;
+
+	if (w->overflow || w->off + TLV_HEADER_SIZE + len > w->size) {
+		w->overflow = true;
+		return;
+	}
+
+	w->buf[w->off] = tag;
+	memcpy(w->buf + w->off + 1, &len16, sizeof(len16));
+	memcpy(w->buf + w->off + TLV_HEADER_SIZE, value, len);
+	w->off += TLV_HEADER_SIZE + len;
+}
+
+static void put_u8(struct tlv_writer *w, u8 tag, u8 value)
+{
+	if (value)
+		put_tlv(w, tag, &value, sizeof(value));
+}
+
+static void put_s32(struct tlv_writer *w, u8 tag, s32 value)
+{
+	if (value)
+		put_tlv(w, tag, &value, sizeof(value));
+}
+
+static void put_string(struct tlv_writer *w, u8 tag, const char *s,
+		       size_t max)
+{
+	size_t len = strnlen(s, max);
+
+	if (len)
+		put_tlv(w, tag, s, len);
+}
+
+static void put_umount_paths(struct tlv_writer *w,
+			     const struct non_root_profile *nrp)
+{
+	char buf[KSU_MAX_UMOUNT_PATHS * KSU_UMOUNT_PATH_MAX];
+	int count = min_t(int, nrp->umount_paths_count, KSU_MAX_UMOUNT_PATHS);
+	size_t len = 0;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		size_t n = strnlen(nrp->umount_paths[i], KSU_UMOUNT_PATH_MAX - 1);
+
+		if (i)
+			buf[len++] = '\0';
+		memcpy(buf + len, nrp->umount_paths[i], n);
+		len += n;
+	}
+
+	if (count)
+		put_tlv(w, KSU_TLV_UMOUNT_PATHS, buf, len);
+}
+
+ssize_t ksu_profile_tlv_encode(const struct app_profile *profile, void *buf,
+			       size_t size)
+{
+	struct tlv_writer w = { .buf = buf, .size = size };
+	const struct root_profile *rp = &profile->rp_config.profile;
+	int groups_count;
+
+	if (size < 1)
+		return -ENOSPC;
+	w.buf[w.off++] = KSU_PROFILE_TLV_VERSION;
+
+	put_tlv(&w, KSU_TLV_PROFILE_VERSION, &profile->version,
+		sizeof(profile->version));
+	put_string(&w, KSU_TLV_KEY, profile->key, sizeof(profile->key));
+	put_s32(&w, KSU_TLV_CURRENT_UID, profile->current_uid);
+	put_u8(&w, KSU_TLV_ALLOW_SU, profile->allow_su);
+
+	if (profile->allow_su) {
+		put_u8(&w, KSU_TLV_USE_DEFAULT, profile->rp_config.use_default);
+		put_string(&w, KSU_TLV_TEMPLATE_NAME,
+			   profile->rp_config.template_name,
+			   sizeof(profile->rp_config.template_name));
+		put_s32(&w, KSU_TLV_UID, rp->uid);
+		put_s32(&w, KSU_TLV_GID, rp->gid);
+		groups_count = clamp(rp->groups_count, 0, KSU_MAX_GROUPS);
+		if (groups_count)
+			put_tlv(&w, KSU_TLV_GROUPS, rp->groups,
+				groups_count * sizeof(rp->groups[0]));
+		if (rp->capabilities.effective || rp->capabilities.permitted ||
+		    rp->capabilities.inheritable)
+			put_tlv(&w, KSU_TLV_CAPABILITIES, &rp->capabilities,
+				sizeof(rp->capabilities));
+		put_string(&w, KSU_TLV_SELINUX_DOMAIN, rp->selinux_domain,
+			   sizeof(rp->selinux_domain));
+		put_s32(&w, KSU_TLV_NAMESPACES, rp->namespaces);
+	} else {
+		put_u8(&w, KSU_TLV_USE_DEFAULT, profile->nrp_config.use_default);
+		put_u8(&w, KSU_TLV_UMOUNT_MODULES,
+		       profile->nrp_config.profile.umount_modules);
+		put_umount_paths(&w, &profile->nrp_config.profile);
+	}
+
+	if (w.overflow)
+		return -ENOSPC;
+
+	return w.off;
+}
+
+static bool get_string(char *dst, size_t size, const u8 *value, u16 len)
+{
+	// we need room for the trailing NUL
+	if (len >= size)
+		return false;
+
+	memcpy(dst, value, len);
+	dst[len] = '\0';
+	return true;
+}
+
+static bool get_umount_paths(struct non_root_profile *nrp, const u8 *value,
+			     u16 len)
+{
+	const u8 *end = value + len;
+
+	nrp->umount_paths_count = 0;
+	while (value <= end) {
+		const u8 *sep = memchr(value, '\0', end - value);
+		const u8 *next = sep ? sep : end;
+
+		if (nrp->umount_paths_count >= KSU_MAX_UMOUNT_PATHS ||
+		    !get_string(nrp->umount_paths[nrp->umount_paths_count],
+				KSU_UMOUNT_PATH_MAX, value, next - value))
+			return false;
+		nrp->umount_paths_count++;
+		value = next + 1;
+	}
+	return true;
+}
+
+int ksu_profile_tlv_decode(const void *buf, size_t len,
+			   struct app_profile *profile)
+{
+	const u8 *p = buf;
+	struct root_profile *rp = &profile->rp_config.profile;
+	bool allow_su_seen = false;
+	size_t off = 1;
+
+	// both configs start with use_default, so it is decoded only once
+	BUILD_BUG_ON(offsetof(struct app_profile, rp_config.use_default) !=
+		     offsetof(struct app_profile, nrp_config.use_default));
+
+	if (len < 1 || p[0] != KSU_PROFILE_TLV_VERSION) {
+		pr_err("profile tlv: unsupported version\n");
+		return -EINVAL;
+	}
+
+	memset(profile, 0, sizeof(*profile));
+
+	while (off + TLV_HEADER_SIZE <= len) {
+		u8 tag = p[off];
+		u16 size;
+		const u8 *value;
+		bool ok = true;
+
+		memcpy(&size, p + off + 1, sizeof(size));
+		value = p + off + TLV_HEADER_SIZE;
+		if (size > len - off - TLV_HEADER_SIZE) {
+			pr_err("profile tlv: item %d truncated\n", tag);
+			return -EINVAL;
+		}
+		off += TLV_HEADER_SIZE + size;
+
+		switch (tag) {
+		case KSU_TLV_PROFILE_VERSION:
+			ok = size == sizeof(profile->version);
+			if (ok)
+				memcpy(&profile->version, value, size);
+			break;
+		case KSU_TLV_KEY:
+			ok = get_string(profile->key, sizeof(profile->key),
+					value, size);
+			break;
+		case KSU_TLV_CURRENT_UID:
+			ok = size == sizeof(profile->current_uid);
+			if (ok)
+				memcpy(&profile->current_uid, value, size);
+			break;
+		case KSU_TLV_ALLOW_SU:
+			ok = size == 1 && !allow_su_seen;
+			profile->allow_su = ok && value[0];
+			allow_su_seen = true;
+			break;
+		case KSU_TLV_USE_DEFAULT:
+			ok = size == 1;
+			if (ok)
+				profile->rp_config.use_default = value[0];
+			break;
+		case KSU_TLV_TEMPLATE_NAME:
+			ok = profile->allow_su &&
+			     get_string(profile->rp_config.template_name,
+					sizeof(profile->rp_config.template_name),
+					value, size);
+			break;
+		case KSU_TLV_UID:
+			ok = profile->allow_su && size == sizeof(rp->uid);
+			if (ok)
+				memcpy(&rp->uid, value, size);
+			break;
+		case KSU_TLV_GID:
+			ok = profile->allow_su && size == sizeof(rp->gid);
+			if (ok)
+				memcpy(&rp->gid, value, size);
+			break;
+		case KSU_TLV_GROUPS:
+			ok = profile->allow_su && size <= sizeof(rp->groups) &&
+			     size % sizeof(rp->groups[0]) == 0;
+			if (ok) {
+				memcpy(rp->groups, value, size);
+				rp->groups_count = size / sizeof(rp->groups[0]);
+			}
+			break;
+		case KSU_TLV_CAPABILITIES:
+			ok = profile->allow_su &&
+			     size == sizeof(rp->capabilities);
+			if (ok)
+				memcpy(&rp->capabilities, value, size);
+			break;
+		case KSU_TLV_SELINUX_DOMAIN:
+			ok = profile->allow_su &&
+			     get_string(rp->selinux_domain,
+					sizeof(rp->selinux_domain), value,
+					size);
+			break;
+		case KSU_TLV_NAMESPACES:
+			ok = profile->allow_su && size == sizeof(rp->namespaces);
+			if (ok)
+				memcpy(&rp->namespaces, value, size);
+			break;
+		case KSU_TLV_UMOUNT_MODULES:
+			ok = !profile->allow_su && size == 1;
+			if (ok)
+				profile->nrp_config.profile.umount_modules =
+					value[0];
+			break;
+		case KSU_TLV_UMOUNT_PATHS:
+			ok = !profile->allow_su &&
+			     get_umount_paths(&profile->nrp_config.profile,
+					      value, size);
+			break;
+		default:
+			// added by a newer version, ignore it
+			break;
+		}
+
+		if (!ok) {
+			pr_err("profile tlv: invalid item %d, size: %d\n", tag,
+			       size);
+			return -EINVAL;
+		}
+	}
+
+	if (off != len) {
+		pr_err("profile tlv: trailing garbage\n");
+		return -EINVAL;
+	}
+
+	return 0;
+}
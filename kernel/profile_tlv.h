@@ -0,0 +1,40 @@
+#ifndef __KSU_H_PROFILE_TLV
+#define __KSU_H_PROFILE_TLV
+
+#include "linux/types.h"
+#include "ksu.h"
+
+/*
+ * Variable length encoding of struct app_profile, used by the prctl ABI and
+ * the allowlist journal. It is a version byte followed by items of
+ * (u8 tag, u16 length, value) in host byte order.
+ * Zero valued fields are omitted, unknown tags are skipped when decoding.
+ * KSU_TLV_ALLOW_SU must come before the fields of the root or non root profile.
+ */
+#define KSU_PROFILE_TLV_VERSION 1
+
+#define KSU_TLV_PROFILE_VERSION 1 // u32, app_profile.version
+#define KSU_TLV_KEY 2 // string without the trailing NUL
+#define KSU_TLV_CURRENT_UID 3 // s32
+#define KSU_TLV_ALLOW_SU 4 // u8
+#define KSU_TLV_USE_DEFAULT 5 // u8, of rp_config or nrp_config
+#define KSU_TLV_TEMPLATE_NAME 6 // string
+#define KSU_TLV_UID 7 // s32
+#define KSU_TLV_GID 8 // s32
+#define KSU_TLV_GROUPS 9 // s32[]
+#define KSU_TLV_CAPABILITIES 10 // u64[3], effective, permitted, inheritable
+#define KSU_TLV_SELINUX_DOMAIN 11 // string
+#define KSU_TLV_NAMESPACES 12 // s32
+#define KSU_TLV_UMOUNT_MODULES 13 // u8
+#define KSU_TLV_UMOUNT_PATHS 14 // strings separated by NUL
+
+// large enough for any encoded profile
+#define KSU_PROFILE_TLV_MAX 1024
+
+ssize_t ksu_profile_tlv_encode(const struct app_profile *profile, void *buf,
+			       size_t size);
+
+int ksu_profile_tlv_decode(const void *buf, size_t len,
+			   struct app_profile *profile);
+
+#endif
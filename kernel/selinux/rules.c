@@ -136,6 +136,9 @@ void apply_kernelsu_rules()
     ksu_allow(db, "system_server", KERNEL_SU_DOMAIN, "process", "sigkill");
 
 	rcu_read_unlock();
+
+	// the policy is loaded by now
+	ksu_selinux_cache_sids();
 }
 
 #define MAX_SEPOL_LEN 128
@@ -473,5 +476,9 @@ exit:
 	// we are in atomic context. so we just reset it every time.
 	reset_avc_cache();
 
+	if (!ret) {
+		ksu_selinux_cache_sids();
+	}
+
 	return ret;
 }
@@ -7,43 +7,40 @@
 #endif
 
 #define KERNEL_SU_DOMAIN "u:r:su:s0"
+#define ZYGOTE_DOMAIN "u:r:zygote:s0"
 
-static int transive_to_domain(const char *domain)
+u32 ksu_domain_to_sid(const char *domain)
 {
-	struct cred *cred;
-	struct task_security_struct *tsec;
-	u32 sid;
+	u32 sid = 0;
 	int error;
 
-	cred = (struct cred *)__task_cred(current);
-
-	tsec = cred->security;
-	if (!tsec) {
-		pr_err("tsec == NULL!\n");
-		return -1;
-	}
-
 	error = security_secctx_to_secid(domain, strlen(domain), &sid);
 	if (error) {
 		pr_info("security_secctx_to_secid %s -> sid: %d, error: %d\n",
 			domain, sid, error);
+		return 0;
 	}
-	if (!error) {
-		tsec->sid = sid;
-		tsec->create_sid = 0;
-		tsec->keycreate_sid = 0;
-		tsec->sockcreate_sid = 0;
-	}
-	return error;
+	return sid;
 }
 
-void setup_selinux(const char *domain)
+void setup_selinux_sid(u32 sid)
 {
-	if (transive_to_domain(domain)) {
-		pr_err("transive domain failed.\n");
+	struct cred *cred;
+	struct task_security_struct *tsec;
+
+	cred = (struct cred *)__task_cred(current);
+
+	tsec = cred->security;
+	if (!tsec) {
+		pr_err("tsec == NULL!\n");
 		return;
 	}
 
+	tsec->sid = sid;
+	tsec->create_sid = 0;
+	tsec->keycreate_sid = 0;
+	tsec->sockcreate_sid = 0;
+
 	/* we didn't need this now, we have change selinux rules when boot!
 if (!is_domain_permissive) {
   if (set_domain_permissive() == 0) {
@@ -52,6 +49,18 @@ if (!is_domain_permissive) {
 }*/
 }
 
+void setup_selinux(const char *domain)
+{
+	u32 sid = ksu_domain_to_sid(domain);
+
+	if (!sid) {
+		pr_err("transive domain failed.\n");
+		return;
+	}
+
+	setup_selinux_sid(sid);
+}
+
 void setenforce(bool enforce)
 {
 #ifdef CONFIG_SECURITY_SELINUX_DEVELOP
@@ -99,34 +108,52 @@ static inline u32 current_sid(void)
 }
 #endif
 
-bool is_ksu_domain()
+// sids of the domains checked on hot paths, 0 until they are known
+static u32 cached_su_sid;
+static u32 cached_zygote_sid;
+
+void ksu_selinux_cache_sids(void)
 {
-	char *domain;
+	WRITE_ONCE(cached_su_sid, ksu_domain_to_sid(KERNEL_SU_DOMAIN));
+	WRITE_ONCE(cached_zygote_sid, ksu_domain_to_sid(ZYGOTE_DOMAIN));
+}
+
+static bool is_sid_of_domain(u32 sid, const char *domain, u32 *cache)
+{
+	u32 cached = READ_ONCE(*cache);
+	char *ctx;
 	u32 seclen;
 	bool result;
-	int err = security_secid_to_secctx(current_sid(), &domain, &seclen);
+
+	if (likely(cached)) {
+		return sid == cached;
+	}
+
+	// the policy is not loaded yet, or we are a module loaded after that
+	int err = security_secid_to_secctx(sid, &ctx, &seclen);
 	if (err) {
 		return false;
 	}
-	result = strncmp(KERNEL_SU_DOMAIN, domain, seclen) == 0;
-	security_release_secctx(domain, seclen);
+	result = strncmp(domain, ctx, seclen) == 0;
+	security_release_secctx(ctx, seclen);
+	if (result) {
+		// learn it from the match, the context of a sid never changes
+		WRITE_ONCE(*cache, sid);
+	}
 	return result;
 }
 
+bool is_ksu_domain()
+{
+	return is_sid_of_domain(current_sid(), KERNEL_SU_DOMAIN,
+				&cached_su_sid);
+}
+
 bool is_zygote(void *sec)
 {
 	struct task_security_struct *tsec = (struct task_security_struct *)sec;
 	if (!tsec) {
 		return false;
 	}
-	char *domain;
-	u32 seclen;
-	bool result;
-	int err = security_secid_to_secctx(tsec->sid, &domain, &seclen);
-	if (err) {
-		return false;
-	}
-	result = strncmp("u:r:zygote:s0", domain, seclen) == 0;
-	security_release_secctx(domain, seclen);
-	return result;
-}
\ No newline at end of file
+	return is_sid_of_domain(tsec->sid, ZYGOTE_DOMAIN, &cached_zygote_sid);
+}
@@ -10,6 +10,11 @@
 
 void setup_selinux(const char *);
 
+// 0 if the domain doesn't exist
+u32 ksu_domain_to_sid(const char *domain);
+
+void setup_selinux_sid(u32 sid);
+
 void setenforce(bool);
 
 bool getenforce();
@@ -20,4 +25,7 @@ bool is_zygote(void *cred);
 
 void apply_kernelsu_rules();
 
+// resolve the sids of su and zygote, after the policy is loaded or changed
+void ksu_selinux_cache_sids(void);
+
 #endif
@@ -2,10 +2,15 @@
 #include "linux/cred.h"
 #include "linux/err.h"
 #include "linux/fs.h"
+#include "linux/ftrace.h"
+#include "linux/jump_label.h"
 #include "linux/kprobes.h"
+#include "linux/ktime.h"
+#include "linux/mutex.h"
 #include "linux/types.h"
 #include "linux/uaccess.h"
 #include "linux/version.h"
+#include "linux/workqueue.h"
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0)
 #include "linux/sched/task_stack.h"
 #else
@@ -14,49 +19,111 @@
 
 #include "allowlist.h"
 #include "arch.h"
+#include "exec_hook.h"
 #include "klog.h" // IWYU pragma: keep
+#include "ksu.h"
 #include "ksud.h"
 #include "kernel_compat.h"
+#include "path_page.h"
+#include "sucompat.h"
+#include "sucompat_stats.h"
+#include "ksu_trace.h"
 
 #define SU_PATH "/system/bin/su"
 #define SH_PATH "/system/bin/sh"
 
+// disabled while the hooks are unregistered, see ksu_disable_sucompat
+DEFINE_STATIC_KEY_TRUE(ksu_sucompat_key);
+
 extern void escape_to_root();
 
 static void __user *userspace_stack_buffer(const void *d, size_t len)
 {
-	/* To avoid having to mmap a page in userspace, just write below the stack
-   * pointer. */
+	/* Until the path page is mapped for the process, just write below the
+	 * stack pointer. */
 	char __user *p = (void __user *)current_user_stack_pointer() - len;
 
 	return copy_to_user(p, d, len) ? NULL : p;
 }
 
-static char __user *sh_user_path(void)
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 6, 0)
+#define sucompat_traced() trace_ksu_sucompat_enabled()
+#else
+// the copy is timed only for the counters
+#define sucompat_traced() false
+#endif
+
+// nops unless the hits are counted in debugfs or traced
+static __always_inline void sucompat_report(int hook, uid_t uid, int result,
+					    bool copied, u64 copy_ns)
 {
-	static const char sh_path[] = "/system/bin/sh";
+	trace_ksu_sucompat(hook, uid, result, copy_ns);
+	if (ksu_sucompat_stats_enabled())
+		ksu_sucompat_account(hook, uid, result, copied, copy_ns);
+}
+
+static __always_inline long sucompat_copy_path(char *dst,
+					       const char __user *src,
+					       long count, u64 *copy_ns)
+{
+	u64 start;
+	long ret;
+
+	if (likely(!ksu_sucompat_stats_enabled() && !sucompat_traced()))
+		return ksu_strncpy_from_user_nofault(dst, src, count);
+
+	start = ktime_get_ns();
+	ret = ksu_strncpy_from_user_nofault(dst, src, count);
+	*copy_ns = ktime_get_ns() - start;
+	return ret;
+}
+
+static const char __user *sh_user_path(void)
+{
+	static const char sh_path[] = SH_PATH;
+	const char __user *p = ksu_path_page_user(KSU_PATH_PAGE_SH);
+
+	if (likely(p))
+		return p;
 
 	return userspace_stack_buffer(sh_path, sizeof(sh_path));
 }
 
+/*
+ * The hooks of faccessat and stat run for every call in the system, uids not
+ * allowed to su must return after the inline bitmap test of ksu_is_allow_uid,
+ * before touching the user memory.
+ */
 int ksu_handle_faccessat(int *dfd, const char __user **filename_user, int *mode,
 			 int *flags)
 {
 	const char su[] = SU_PATH;
+	char path[sizeof(su) + 1];
+	long len;
+	uid_t uid;
+	int result = KSU_SUCOMPAT_PASS;
+	u64 copy_ns = 0;
 
-	if (!ksu_is_allow_uid(current_uid().val)) {
+	if (!ksu_sucompat_active()) {
 		return 0;
 	}
 
-	char path[sizeof(su) + 1];
-	memset(path, 0, sizeof(path));
-	ksu_strncpy_from_user_nofault(path, *filename_user, sizeof(path));
+	uid = current_uid().val;
+	if (!ksu_is_allow_uid(uid)) {
+		sucompat_report(KSU_SUCOMPAT_FACCESSAT, uid, KSU_SUCOMPAT_MISS,
+				false, 0);
+		return 0;
+	}
 
-	if (unlikely(!memcmp(path, su, sizeof(su)))) {
+	// the bytes after the NUL don't matter, they can't make it match
+	len = sucompat_copy_path(path, *filename_user, sizeof(path), &copy_ns);
+	if (len >= 0 && unlikely(!memcmp(path, su, sizeof(su)))) {
 		pr_info("faccessat su->sh!\n");
 		*filename_user = sh_user_path();
+		result = KSU_SUCOMPAT_REWRITE;
 	}
 
+	sucompat_report(KSU_SUCOMPAT_FACCESSAT, uid, result, true, copy_ns);
 	return 0;
 }
 
@@ -64,8 +131,16 @@ int ksu_handle_stat(int *dfd, const char __user **filename_user, int *flags)
 {
 	// const char sh[] = SH_PATH;
 	const char su[] = SU_PATH;
+	uid_t uid;
 
-	if (!ksu_is_allow_uid(current_uid().val)) {
+	if (!ksu_sucompat_active()) {
+		return 0;
+	}
+
+	uid = current_uid().val;
+	if (!ksu_is_allow_uid(uid)) {
+		sucompat_report(KSU_SUCOMPAT_STAT, uid, KSU_SUCOMPAT_MISS, false,
+				0);
 		return 0;
 	}
 
@@ -73,8 +148,6 @@ int ksu_handle_stat(int *dfd, const char __user **filename_user, int *flags)
 		return 0;
 	}
 
-	char path[sizeof(su) + 1];
-	memset(path, 0, sizeof(path));
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0)
 	// it becomes a `struct filename *` after 5.18
 	// https://elixir.bootlin.com/linux/v5.18/source/fs/stat.c#L216
@@ -83,52 +156,73 @@ int ksu_handle_stat(int *dfd, const char __user **filename_user, int *flags)
 	if (IS_ERR(filename)) {
 		return 0;
 	}
-	if (likely(memcmp(filename->name, su, sizeof(su))))
+	if (likely(memcmp(filename->name, su, sizeof(su)))) {
+		sucompat_report(KSU_SUCOMPAT_STAT, uid, KSU_SUCOMPAT_PASS, false,
+				0);
 		return 0;
+	}
 	pr_info("vfs_statx su->sh!\n");
 	memcpy((void *)filename->name, sh, sizeof(sh));
+	sucompat_report(KSU_SUCOMPAT_STAT, uid, KSU_SUCOMPAT_REWRITE, false, 0);
 #else
-	ksu_strncpy_from_user_nofault(path, *filename_user, sizeof(path));
+	char path[sizeof(su) + 1];
+	long len;
+	int result = KSU_SUCOMPAT_PASS;
+	u64 copy_ns = 0;
 
-	if (unlikely(!memcmp(path, su, sizeof(su)))) {
+	len = sucompat_copy_path(path, *filename_user, sizeof(path), &copy_ns);
+	if (len >= 0 && unlikely(!memcmp(path, su, sizeof(su)))) {
 		pr_info("newfstatat su->sh!\n");
 		*filename_user = sh_user_path();
+		result = KSU_SUCOMPAT_REWRITE;
 	}
+
+	sucompat_report(KSU_SUCOMPAT_STAT, uid, result, true, copy_ns);
 #endif
 
 	return 0;
 }
 
-// the call from execve_handler_pre won't provided correct value for __never_use_argument, use them after fix execve_handler_pre, keeping them for consistence for manually patched code
-int ksu_handle_execveat_sucompat(int *fd, struct filename **filename_ptr,
-				 void *__never_use_argv, void *__never_use_envp, int *__never_use_flags)
+int __ksu_handle_execveat_sucompat(int match, struct filename **filename_ptr)
 {
-	struct filename *filename;
 	const char sh[] = KSUD_PATH;
-	const char su[] = SU_PATH;
+	uid_t uid;
 
-	if (unlikely(!filename_ptr))
+	if (!ksu_sucompat_active())
 		return 0;
 
-	filename = *filename_ptr;
-	if (IS_ERR(filename)) {
+	uid = current_uid().val;
+	if (likely(match != KSU_EXEC_SU)) {
+		sucompat_report(KSU_SUCOMPAT_EXECVE, uid, KSU_SUCOMPAT_PASS,
+				false, 0);
 		return 0;
 	}
 
-	if (likely(memcmp(filename->name, su, sizeof(su))))
-		return 0;
-
-	if (!ksu_is_allow_uid(current_uid().val))
+	if (!ksu_is_allow_uid(uid)) {
+		sucompat_report(KSU_SUCOMPAT_EXECVE, uid, KSU_SUCOMPAT_MISS,
+				false, 0);
 		return 0;
+	}
 
 	pr_info("do_execveat_common su found\n");
-	memcpy((void *)filename->name, sh, sizeof(sh));
+	memcpy((void *)(*filename_ptr)->name, sh, sizeof(sh));
+	sucompat_report(KSU_SUCOMPAT_EXECVE, uid, KSU_SUCOMPAT_REWRITE, false,
+			0);
 
 	escape_to_root();
 
 	return 0;
 }
 
+// keeping the unused arguments for consistence for manually patched code
+int ksu_handle_execveat_sucompat(int *fd, struct filename **filename_ptr,
+				 void *__never_use_argv, void *__never_use_envp,
+				 int *__never_use_flags)
+{
+	return __ksu_handle_execveat_sucompat(ksu_exec_match(filename_ptr),
+					      filename_ptr);
+}
+
 #ifdef CONFIG_KPROBES
 
 static int faccessat_handler_pre(struct kprobe *p, struct pt_regs *regs)
@@ -157,15 +251,50 @@ static int newfstatat_handler_pre(struct kprobe *p, struct pt_regs *regs)
 	return ksu_handle_stat(dfd, filename_user, flags);
 }
 
-// https://elixir.bootlin.com/linux/v5.10.158/source/fs/exec.c#L1864
-static int execve_handler_pre(struct kprobe *p, struct pt_regs *regs)
-{
-	int *fd = (int *)&PT_REGS_PARM1(regs);
-	struct filename **filename_ptr =
-		(struct filename **)&PT_REGS_PARM2(regs);
+#ifdef CONFIG_DYNAMIC_FTRACE_WITH_REGS
+/*
+ * faccessat and stat are hooked with ftrace if the arch can save the
+ * registers for us, which is a call from the patched function entry instead
+ * of the breakpoint trap of a kprobe. The kprobes are used if it fails.
+ */
+#define KSU_SUCOMPAT_FTRACE
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 11, 0)
+#define KSU_FTRACE_HANDLER(name, handler)                                      \
+	static void notrace name(unsigned long ip, unsigned long parent_ip,    \
+				 struct ftrace_ops *ops,                       \
+				 struct ftrace_regs *fregs)                    \
+	{                                                                      \
+		struct pt_regs *regs = ftrace_get_regs(fregs);                 \
+		if (regs)                                                      \
+			handler(NULL, regs);                                   \
+	}
+// ftrace guards against recursion only if we ask for it since 5.11
+#define KSU_FTRACE_FLAGS (FTRACE_OPS_FL_SAVE_REGS | FTRACE_OPS_FL_RECURSION)
+#else
+#define KSU_FTRACE_HANDLER(name, handler)                                      \
+	static void notrace name(unsigned long ip, unsigned long parent_ip,    \
+				 struct ftrace_ops *ops, struct pt_regs *regs) \
+	{                                                                      \
+		if (regs)                                                      \
+			handler(NULL, regs);                                   \
+	}
+#define KSU_FTRACE_FLAGS FTRACE_OPS_FL_SAVE_REGS
+#endif
 
-	return ksu_handle_execveat_sucompat(fd, filename_ptr, NULL, NULL, NULL);
-}
+KSU_FTRACE_HANDLER(faccessat_ftrace_handler, faccessat_handler_pre)
+KSU_FTRACE_HANDLER(newfstatat_ftrace_handler, newfstatat_handler_pre)
+
+static struct ftrace_ops faccessat_ops = {
+	.func = faccessat_ftrace_handler,
+	.flags = KSU_FTRACE_FLAGS,
+};
+
+static struct ftrace_ops newfstatat_ops = {
+	.func = newfstatat_ftrace_handler,
+	.flags = KSU_FTRACE_FLAGS,
+};
+#endif
 
 static struct kprobe faccessat_kp = {
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 17, 0)
@@ -185,29 +314,135 @@ static struct kprobe newfstatat_kp = {
 	.pre_handler = newfstatat_handler_pre,
 };
 
-static struct kprobe execve_kp = {
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 9, 0)
-	.symbol_name = "do_execveat_common",
-#elif LINUX_VERSION_CODE >= KERNEL_VERSION(4, 19, 0)
-	.symbol_name = "__do_execve_file",
-#elif LINUX_VERSION_CODE >= KERNEL_VERSION(3, 19, 0)
-	.symbol_name = "do_execveat_common",
+// hook the symbol of kp with ops if ftrace is usable, otherwise with kp
+static int register_sucompat_hook(struct kprobe *kp, struct ftrace_ops *ops)
+{
+#ifdef KSU_SUCOMPAT_FTRACE
+	const char *symbol = kp->symbol_name;
+	int ret;
+
+	if (ops) {
+		ret = ftrace_set_filter(ops, (unsigned char *)symbol,
+					strlen(symbol), 1);
+		if (!ret) {
+			ret = register_ftrace_function(ops);
+		}
+		if (!ret) {
+			pr_info("sucompat: ftrace %s\n", symbol);
+			return 0;
+		}
+		ftrace_free_filter(ops);
+		pr_info("sucompat: ftrace %s: %d, use kprobe\n", symbol, ret);
+	}
+#endif
+	// a kprobe keeps the resolved address, which fails registering it again
+	kp->addr = NULL;
+	kp->flags = 0;
+	return register_kprobe(kp);
+}
+
+static void unregister_sucompat_hook(struct kprobe *kp, struct ftrace_ops *ops)
+{
+#ifdef KSU_SUCOMPAT_FTRACE
+	if (ops && (ops->flags & FTRACE_OPS_FL_ENABLED)) {
+		unregister_ftrace_function(ops);
+		ftrace_free_filter(ops);
+		return;
+	}
+#endif
+	if (kp->addr) {
+		unregister_kprobe(kp);
+	}
+}
+
+#ifdef KSU_SUCOMPAT_FTRACE
+#define SUCOMPAT_FTRACE_OPS(ops) (&(ops))
+#else
+#define SUCOMPAT_FTRACE_OPS(ops) NULL
 #endif
-	.pre_handler = execve_handler_pre,
-};
 
 #endif
 
+// serializes enabling and disabling the hooks
+static DEFINE_MUTEX(sucompat_mutex);
+static bool sucompat_registered;
+// registered and none of the hooks failed, what CMD_IS_SU_ENABLED reports
+static bool sucompat_hooked;
+
 // sucompat: permited process can execute 'su' to gain root access.
 void ksu_enable_sucompat()
 {
+	mutex_lock(&sucompat_mutex);
+	if (sucompat_registered) {
+		goto out;
+	}
+	bool failed = false;
 #ifdef CONFIG_KPROBES
 	int ret;
-	ret = register_kprobe(&execve_kp);
-	pr_info("sucompat: execve_kp: %d\n", ret);
-	ret = register_kprobe(&newfstatat_kp);
+	// the kprobe is unregistered as a whole if it fails, so it is safe to retry
+	ret = ksu_exec_hook_get(KSU_EXEC_HOOK_SUCOMPAT);
+	pr_info("sucompat: exec hook: %d\n", ret);
+	failed |= ret != 0;
+	ret = register_sucompat_hook(&newfstatat_kp,
+				     SUCOMPAT_FTRACE_OPS(newfstatat_ops));
 	pr_info("sucompat: newfstatat_kp: %d\n", ret);
-	ret = register_kprobe(&faccessat_kp);
+	failed |= ret != 0;
+	ret = register_sucompat_hook(&faccessat_kp,
+				     SUCOMPAT_FTRACE_OPS(faccessat_ops));
 	pr_info("sucompat: faccessat_kp: %d\n", ret);
+	failed |= ret != 0;
+#endif
+	// kept registered on failure, so that disabling cleans up the others
+	sucompat_registered = true;
+	WRITE_ONCE(sucompat_hooked, !failed);
+	static_branch_enable(&ksu_sucompat_key);
+out:
+	mutex_unlock(&sucompat_mutex);
+}
+
+void ksu_disable_sucompat()
+{
+	mutex_lock(&sucompat_mutex);
+	if (!sucompat_registered) {
+		goto out;
+	}
+	// for the hooks patched into the kernel, which can't be unregistered
+	static_branch_disable(&ksu_sucompat_key);
+#ifdef CONFIG_KPROBES
+	ksu_exec_hook_put(KSU_EXEC_HOOK_SUCOMPAT);
+	unregister_sucompat_hook(&newfstatat_kp,
+				 SUCOMPAT_FTRACE_OPS(newfstatat_ops));
+	unregister_sucompat_hook(&faccessat_kp,
+				 SUCOMPAT_FTRACE_OPS(faccessat_ops));
 #endif
+	sucompat_registered = false;
+	WRITE_ONCE(sucompat_hooked, false);
+	pr_info("sucompat: disabled\n");
+out:
+	mutex_unlock(&sucompat_mutex);
+}
+
+// what the last ksu_set_sucompat asked for
+static bool sucompat_wanted = true;
+
+static void do_update_sucompat(struct work_struct *work)
+{
+	if (READ_ONCE(sucompat_wanted)) {
+		ksu_enable_sucompat();
+	} else {
+		ksu_disable_sucompat();
+	}
+}
+
+static DECLARE_WORK(sucompat_work, do_update_sucompat);
+
+void ksu_set_sucompat(bool enable)
+{
+	WRITE_ONCE(sucompat_wanted, enable);
+	ksu_queue_work(&sucompat_work);
+}
+
+bool ksu_sucompat_enabled()
+{
+	return READ_ONCE(sucompat_hooked);
 }
@@ -0,0 +1,39 @@
+#ifndef __KSU_H_SUCOMPAT
+#define __KSU_H_SUCOMPAT
+
+#include "linux/fs.h"
+#include "linux/jump_label.h"
+#include "linux/types.h"
+
+DECLARE_STATIC_KEY_TRUE(ksu_sucompat_key);
+
+// whether the su compatibility hooks should do anything, a nop when enabled
+static inline bool ksu_sucompat_active(void)
+{
+	return static_branch_likely(&ksu_sucompat_key);
+}
+
+// match is the KSU_EXEC_* of the file executed
+int __ksu_handle_execveat_sucompat(int match, struct filename **filename_ptr);
+
+/*
+ * Register or unregister the hooks making /system/bin/su work for the allowed
+ * apps, so that devices which don't need it don't pay for the hooks of execve,
+ * stat and faccessat. They are registered at boot, ksud disables them as
+ * early as post-fs-data if it is configured so.
+ */
+void ksu_enable_sucompat(void);
+void ksu_disable_sucompat(void);
+
+/*
+ * Like above, from the prctl handler, which can't register or unregister
+ * kprobes itself as it runs in a kprobe. It is done by the work queue.
+ */
+void ksu_set_sucompat(bool enable);
+/*
+ * Whether all the hooks are registered now, it is false if any of them failed.
+ * It changes only once the work queued by ksu_set_sucompat has run.
+ */
+bool ksu_sucompat_enabled(void);
+
+#endif
@@ -0,0 +1,226 @@
+#include "linux/atomic.h"
+#include "linux/debugfs.h"
+#include "linux/fs.h"
+#include "linux/hash.h"
+#include "linux/kernel.h"
+#include "linux/math64.h"
+#include "linux/mutex.h"
+#include "linux/rcupdate.h"
+#include "linux/seq_file.h"
+#include "linux/string.h"
+#include "linux/uaccess.h"
+#include "linux/vmalloc.h"
+
+#include "klog.h" // IWYU pragma: keep
+#include "prctl_stats.h"
+#include "sucompat_stats.h"
+
+#define STATS_TABLE_BITS 10
+#define STATS_TABLE_SIZE (1 << STATS_TABLE_BITS)
+// slots probed for a uid before it is counted as dropped
+#define STATS_PROBES 8
+
+DEFINE_STATIC_KEY_FALSE(ksu_sucompat_stats_key);
+
+struct sucompat_hook_stats {
+	atomic_long_t calls[3]; // indexed by KSU_SUCOMPAT_*
+	atomic_long_t copies;
+	atomic64_t copy_ns;
+};
+
+struct sucompat_uid_stats {
+	// uid + 1, 0 for the unused entries
+	atomic_t key;
+	struct sucompat_hook_stats hooks[KSU_SUCOMPAT_HOOK_COUNT];
+};
+
+static const char *const hook_names[KSU_SUCOMPAT_HOOK_COUNT] = {
+	[KSU_SUCOMPAT_EXECVE] = "execve",
+	[KSU_SUCOMPAT_FACCESSAT] = "faccessat",
+	[KSU_SUCOMPAT_STAT] = "stat",
+};
+
+static DEFINE_MUTEX(stats_mutex);
+// allocated when the counting is enabled for the first time
+static struct sucompat_uid_stats __rcu *stats_table;
+// hits of the uids not fitting in the table
+static atomic_long_t stats_dropped;
+
+// the hooks run for every uid, so a slot is claimed without any lock
+static struct sucompat_uid_stats *uid_stats(struct sucompat_uid_stats *table,
+					    uid_t uid)
+{
+	int key = uid + 1;
+	u32 slot = hash_32(uid, STATS_TABLE_BITS);
+	int i;
+
+	for (i = 0; i < STATS_PROBES; i++) {
+		struct sucompat_uid_stats *e =
+			&table[(slot + i) & (STATS_TABLE_SIZE - 1)];
+		int old = atomic_read(&e->key);
+
+		if (!old)
+			old = atomic_cmpxchg(&e->key, 0, key);
+		if (!old || old == key)
+			return e;
+	}
+
+	return NULL;
+}
+
+void ksu_sucompat_account(int hook, uid_t uid, int result, bool copied,
+			  u64 copy_ns)
+{
+	struct sucompat_uid_stats *table;
+	struct sucompat_uid_stats *e;
+	struct sucompat_hook_stats *stats;
+
+	rcu_read_lock();
+	table = rcu_dereference(stats_table);
+	if (!table)
+		goto out;
+
+	e = uid_stats(table, uid);
+	if (!e) {
+		atomic_long_inc(&stats_dropped);
+		goto out;
+	}
+
+	stats = &e->hooks[hook];
+	atomic_long_inc(&stats->calls[result]);
+	if (copied) {
+		atomic_long_inc(&stats->copies);
+		atomic64_add(copy_ns, &stats->copy_ns);
+	}
+out:
+	rcu_read_unlock();
+}
+
+static int sucompat_stats_show(struct seq_file *m, void *v)
+{
+	struct sucompat_uid_stats *table;
+	int i, hook;
+
+	seq_printf(m, "enabled: %d\ndropped: %lu\n",
+		   static_key_enabled(&ksu_sucompat_stats_key),
+		   atomic_long_read(&stats_dropped));
+	seq_puts(m, "uid hook pass miss rewrite copies avg_copy_ns\n");
+
+	rcu_read_lock();
+	table = rcu_dereference(stats_table);
+	for (i = 0; table && i < STATS_TABLE_SIZE; i++) {
+		struct sucompat_uid_stats *e = &table[i];
+		int key = atomic_read(&e->key);
+
+		if (!key)
+			continue;
+
+		for (hook = 0; hook < KSU_SUCOMPAT_HOOK_COUNT; hook++) {
+			struct sucompat_hook_stats *stats = &e->hooks[hook];
+			long pass = atomic_long_read(
+				&stats->calls[KSU_SUCOMPAT_PASS]);
+			long miss = atomic_long_read(
+				&stats->calls[KSU_SUCOMPAT_MISS]);
+			long rewrite = atomic_long_read(
+				&stats->calls[KSU_SUCOMPAT_REWRITE]);
+			long copies = atomic_long_read(&stats->copies);
+			u64 copy_ns = atomic64_read(&stats->copy_ns);
+
+			if (!pass && !miss && !rewrite)
+				continue;
+
+			seq_printf(m, "%u %s %ld %ld %ld %ld %llu\n",
+				   (uid_t)(key - 1), hook_names[hook], pass,
+				   miss, rewrite, copies,
+				   copies ? div64_u64(copy_ns, copies) : 0);
+		}
+	}
+	rcu_read_unlock();
+
+	return 0;
+}
+
+static int sucompat_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, sucompat_stats_show, NULL);
+}
+
+// write 1 to reset the counters and start counting, 0 to stop
+static ssize_t sucompat_stats_write(struct file *file, const char __user *buf,
+				    size_t count, loff_t *ppos)
+{
+	struct sucompat_uid_stats *table;
+	unsigned int enable;
+	int ret;
+
+	ret = kstrtouint_from_user(buf, count, 0, &enable);
+	if (ret)
+		return ret;
+
+	mutex_lock(&stats_mutex);
+	if (!enable) {
+		static_branch_disable(&ksu_sucompat_stats_key);
+		goto out;
+	}
+
+	if (static_key_enabled(&ksu_sucompat_stats_key)) {
+		// stop counting while resetting, so the hooks don't mix in
+		static_branch_disable(&ksu_sucompat_stats_key);
+		synchronize_rcu();
+	}
+
+	table = rcu_dereference_protected(stats_table,
+					  lockdep_is_held(&stats_mutex));
+	if (table) {
+		// a hook past the key may still be counting, they are just stats
+		memset(table, 0, STATS_TABLE_SIZE * sizeof(*table));
+	} else {
+		table = vzalloc(STATS_TABLE_SIZE * sizeof(*table));
+		if (!table) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		rcu_assign_pointer(stats_table, table);
+	}
+	atomic_long_set(&stats_dropped, 0);
+	static_branch_enable(&ksu_sucompat_stats_key);
+out:
+	mutex_unlock(&stats_mutex);
+
+	return ret ?: count;
+}
+
+static const struct file_operations sucompat_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = sucompat_stats_open,
+	.read = seq_read,
+	.write = sucompat_stats_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+void ksu_sucompat_stats_init(void)
+{
+	// no debugfs, counting just can't be enabled
+	if (!ksu_debugfs_dir)
+		return;
+
+	debugfs_create_file("sucompat_stats", 0600, ksu_debugfs_dir, NULL,
+			    &sucompat_stats_fops);
+}
+
+// call it after ksu_prctl_stats_exit, which removes the file
+void ksu_sucompat_stats_exit(void)
+{
+	struct sucompat_uid_stats *table;
+
+	mutex_lock(&stats_mutex);
+	static_branch_disable(&ksu_sucompat_stats_key);
+	table = rcu_dereference_protected(stats_table,
+					  lockdep_is_held(&stats_mutex));
+	RCU_INIT_POINTER(stats_table, NULL);
+	mutex_unlock(&stats_mutex);
+
+	synchronize_rcu();
+	vfree(table);
+}
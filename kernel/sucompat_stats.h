@@ -0,0 +1,40 @@
+#ifndef __KSU_H_SUCOMPAT_STATS
+#define __KSU_H_SUCOMPAT_STATS
+
+#include "linux/jump_label.h"
+#include "linux/types.h"
+
+#define KSU_SUCOMPAT_EXECVE 0
+#define KSU_SUCOMPAT_FACCESSAT 1
+#define KSU_SUCOMPAT_STAT 2
+#define KSU_SUCOMPAT_HOOK_COUNT 3
+
+// what a hook did after it was hit
+#define KSU_SUCOMPAT_PASS 0 // the path is not su
+#define KSU_SUCOMPAT_MISS 1 // the uid is not allowed to su
+#define KSU_SUCOMPAT_REWRITE 2 // su is replaced
+
+DECLARE_STATIC_KEY_FALSE(ksu_sucompat_stats_key);
+
+/*
+ * The branch is patched to a nop unless the counting is enabled in
+ * <debugfs>/ksu/sucompat_stats, the hooks check it before timing the copy of
+ * the user path.
+ */
+static __always_inline bool ksu_sucompat_stats_enabled(void)
+{
+	return static_branch_unlikely(&ksu_sucompat_stats_key);
+}
+
+/*
+ * Count a hit of the hook by uid with its result, copy_ns is the time spent in
+ * copying the path from the user memory, or 0 if it is not copied.
+ * execve checks the allowlist only for su, its misses are the su denied.
+ */
+void ksu_sucompat_account(int hook, uid_t uid, int result, bool copied,
+			  u64 copy_ns);
+
+void ksu_sucompat_stats_init(void);
+void ksu_sucompat_stats_exit(void);
+
+#endif
@@ -0,0 +1,114 @@
+#include "linux/hash.h"
+#include "linux/jiffies.h"
+#include "linux/kernel.h"
+#include "linux/spinlock.h"
+#include "linux/types.h"
+
+#include "klog.h" // IWYU pragma: keep
+#include "throttle.h"
+
+#define THROTTLE_SET_BITS 5
+#define THROTTLE_WAYS 2
+// failures allowed in a row
+#define THROTTLE_BURST 8
+// and then one per interval
+#define THROTTLE_REFILL_INTERVAL HZ
+
+struct throttle_entry {
+	uid_t uid;
+	u32 tokens;
+	unsigned long stamp;
+};
+
+static struct throttle_entry throttle_table[(1 << THROTTLE_SET_BITS) *
+					    THROTTLE_WAYS];
+static DEFINE_SPINLOCK(throttle_lock);
+
+// must be called with throttle_lock held
+static void refill_locked(struct throttle_entry *e, unsigned long now)
+{
+	unsigned long intervals = (now - e->stamp) / THROTTLE_REFILL_INTERVAL;
+
+	if (!intervals)
+		return;
+
+	if (intervals >= THROTTLE_BURST - e->tokens) {
+		e->tokens = THROTTLE_BURST;
+		e->stamp = now;
+	} else {
+		e->tokens += intervals;
+		e->stamp += intervals * THROTTLE_REFILL_INTERVAL;
+	}
+}
+
+static struct throttle_entry *throttle_set(uid_t uid)
+{
+	return &throttle_table[hash_32(uid, THROTTLE_SET_BITS) * THROTTLE_WAYS];
+}
+
+// must be called with throttle_lock held
+static struct throttle_entry *find_locked(uid_t uid)
+{
+	struct throttle_entry *set = throttle_set(uid);
+	int i;
+
+	for (i = 0; i < THROTTLE_WAYS; i++) {
+		// stamp is 0 only for the unused entries
+		if (set[i].uid == uid && set[i].stamp)
+			return &set[i];
+	}
+
+	return NULL;
+}
+
+bool ksu_uid_throttled(uid_t uid)
+{
+	struct throttle_entry *e;
+	bool throttled = false;
+
+	spin_lock(&throttle_lock);
+	e = find_locked(uid);
+	if (e) {
+		refill_locked(e, jiffies);
+		throttled = !e->tokens;
+	}
+	spin_unlock(&throttle_lock);
+
+	return throttled;
+}
+
+void ksu_uid_failed(uid_t uid)
+{
+	struct throttle_entry *set = throttle_set(uid);
+	struct throttle_entry *e;
+	unsigned long now = jiffies;
+	int i;
+
+	spin_lock(&throttle_lock);
+	e = find_locked(uid);
+	if (!e) {
+		// replace the one with the most tokens, a full bucket is the
+		// same as no entry at all
+		e = &set[0];
+		for (i = 0; i < THROTTLE_WAYS; i++) {
+			if (!set[i].stamp) {
+				e = &set[i];
+				break;
+			}
+			refill_locked(&set[i], now);
+			if (set[i].tokens > e->tokens)
+				e = &set[i];
+		}
+		e->uid = uid;
+		e->tokens = THROTTLE_BURST;
+		// 0 means unused
+		e->stamp = now ?: 1;
+	}
+
+	if (e->tokens) {
+		e->tokens--;
+		if (!e->tokens)
+			pr_info("throttle prctl of uid: %d\n", uid);
+	}
+	spin_unlock(&throttle_lock);
+}
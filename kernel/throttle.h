@@ -0,0 +1,15 @@
+#ifndef __KSU_H_THROTTLE
+#define __KSU_H_THROTTLE
+
+#include "linux/types.h"
+
+/*
+ * Negative cache of uids which failed a prctl, e.g. a bad CMD_BECOME_MANAGER.
+ * Each of them has a token bucket, a failure takes a token and the uid is
+ * ignored while its bucket is empty. Uids which never fail cost nothing.
+ */
+bool ksu_uid_throttled(uid_t uid);
+
+void ksu_uid_failed(uid_t uid);
+
+#endif
@@ -0,0 +1,337 @@
+#include "linux/cred.h"
+#include "linux/err.h"
+#include "linux/fs.h"
+#include "linux/init_task.h"
+#include "linux/kernel.h"
+#include "linux/list.h"
+#include "linux/mount.h"
+#include "linux/namei.h"
+#include "linux/nsproxy.h"
+#include "linux/path.h"
+#include "linux/rwsem.h"
+#include "linux/sched.h"
+#include "linux/slab.h"
+#include "linux/string.h"
+#include "linux/syscalls.h"
+#include "linux/task_work.h"
+#include "linux/timekeeping.h"
+#include "linux/uaccess.h"
+#include "linux/version.h"
+
+#include "allowlist.h"
+#include "kernel_compat.h"
+#include "klog.h" // IWYU pragma: keep
+#include "umount.h"
+
+#define CREATE_TRACE_POINTS
+#include "ksu_trace.h"
+
+#define KSU_MAX_TRY_UMOUNT 64
+
+struct try_umount_entry {
+	struct list_head list;
+	// the superblock of the mount when it was added, the copies of it in
+	// other mount namespaces share it. Only compared, never dereferenced.
+	const struct super_block *sb;
+	int flags;
+	char path[];
+};
+
+// writers are ksud only, readers may sleep in kern_path and umount
+static DECLARE_RWSEM(try_umount_lock);
+static LIST_HEAD(try_umount_list);
+static int try_umount_count;
+
+int ksu_add_try_umount(const char *path, int flags)
+{
+	struct try_umount_entry *entry = NULL;
+	struct path kpath;
+	size_t len = strlen(path);
+	int err;
+
+	if (flags & ~(MNT_FORCE | MNT_DETACH | MNT_EXPIRE | UMOUNT_NOFOLLOW))
+		return -EINVAL;
+
+	err = kern_path(path, 0, &kpath);
+	if (err)
+		return err;
+
+	if (kpath.dentry != kpath.mnt->mnt_root) {
+		path_put(&kpath);
+		return -EINVAL;
+	}
+
+	entry = kmalloc(sizeof(*entry) + len + 1, GFP_KERNEL);
+	if (!entry) {
+		path_put(&kpath);
+		return -ENOMEM;
+	}
+	entry->sb = kpath.mnt->mnt_sb;
+	entry->flags = flags;
+	memcpy(entry->path, path, len + 1);
+	path_put(&kpath);
+
+	down_write(&try_umount_lock);
+	if (try_umount_count >= KSU_MAX_TRY_UMOUNT) {
+		up_write(&try_umount_lock);
+		kfree(entry);
+		return -ENOSPC;
+	}
+	list_add_tail(&entry->list, &try_umount_list);
+	try_umount_count++;
+	up_write(&try_umount_lock);
+
+	pr_info("add try umount: %s, flags: %d\n", path, flags);
+	return 0;
+}
+
+void ksu_clear_try_umount(void)
+{
+	struct try_umount_entry *entry, *n;
+
+	down_write(&try_umount_lock);
+	list_for_each_entry_safe (entry, n, &try_umount_list, list) {
+		list_del(&entry->list);
+		kfree(entry);
+	}
+	try_umount_count = 0;
+	up_write(&try_umount_lock);
+}
+
+/*
+ * Umount the mount of path, which is a reference to the root of the mount at
+ * mnt, the reference is dropped.
+ */
+static bool ksu_umount_mnt(const char *mnt, struct path *path, int flags)
+{
+	int err;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 9, 0)
+	err = path_umount(path, flags);
+#else
+	mm_segment_t old_fs;
+
+	/*
+	 * There is no path_umount and do_umount is static, so umount it by name
+	 * the way the syscall does, which looks the path up a second time. The
+	 * checks of the caller apply to the first lookup only: a mount
+	 * propagated into this namespace in between would be umounted instead.
+	 * The umount is by path without a second lookup only on 5.9+.
+	 */
+	path_put(path);
+	old_fs = get_fs();
+	set_fs(KERNEL_DS);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 17, 0)
+	err = ksys_umount((char __user *)mnt, flags | UMOUNT_NOFOLLOW);
+#else
+	err = sys_umount((char __user *)mnt, flags | UMOUNT_NOFOLLOW);
+#endif
+	set_fs(old_fs);
+#endif
+	if (err) {
+		pr_info("umount %s failed: %d\n", mnt, err);
+		return false;
+	}
+	return true;
+}
+
+static bool is_overlay(struct path *path)
+{
+	if (path->mnt && path->mnt->mnt_sb && path->mnt->mnt_sb->s_type) {
+		const char *fstype = path->mnt->mnt_sb->s_type->name;
+		return strcmp(fstype, "overlay") == 0;
+	}
+	return false;
+}
+
+/*
+ * sb is the superblock the mount must have, NULL to only accept overlayfs if
+ * check_mnt is set. Returns true if it is umounted.
+ */
+static bool try_umount(const char *mnt, const struct super_block *sb,
+		       bool check_mnt, int flags)
+{
+	struct path path;
+	int err = kern_path(mnt, 0, &path);
+	if (err) {
+		return false;
+	}
+
+	if (path.dentry != path.mnt->mnt_root) {
+		// it is not root mountpoint, maybe umounted by others already.
+		path_put(&path);
+		return false;
+	}
+
+	// we are only interest in some specific mounts
+	if ((sb && path.mnt->mnt_sb != sb) ||
+	    (!sb && check_mnt && !is_overlay(&path))) {
+		path_put(&path);
+		return false;
+	}
+
+	return ksu_umount_mnt(mnt, &path, flags);
+}
+
+/*
+ * Whether path is at or under one of the umount paths of the profile, which
+ * are sorted, so no path after the first one greater than it can match.
+ */
+static bool is_umount_path(const struct non_root_profile *profile,
+			   const char *path)
+{
+	u8 i;
+
+	if (!profile->umount_paths_count) {
+		return true;
+	}
+
+	for (i = 0; i < profile->umount_paths_count; i++) {
+		const char *prefix = profile->umount_paths[i];
+		size_t len = strlen(prefix);
+		int cmp = strncmp(path, prefix, len);
+
+		if (cmp < 0) {
+			break;
+		}
+		if (!cmp && (path[len] == '\0' || path[len] == '/' || len == 1)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+struct legacy_umount_path {
+	const char *path;
+	bool check_mnt;
+	int flags;
+};
+
+// for ksud which doesn't tell us what it has mounted
+static const struct legacy_umount_path legacy_umount_paths[] = {
+	{ "/system", true, 0 },
+	{ "/vendor", true, 0 },
+	{ "/product", true, 0 },
+	{ "/data/adb/modules", false, MNT_DETACH },
+	// ksu temp path
+	{ "/debug_ramdisk", false, MNT_DETACH },
+	{ "/sbin", false, MNT_DETACH },
+};
+
+static int umount_legacy_paths(const struct non_root_profile *profile)
+{
+	int count = 0;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(legacy_umount_paths); i++) {
+		const struct legacy_umount_path *p = &legacy_umount_paths[i];
+
+		if (is_umount_path(profile, p->path)) {
+			count += try_umount(p->path, NULL, p->check_mnt,
+					    p->flags);
+		}
+	}
+
+	return count;
+}
+
+/*
+ * Umount the mounts selected by the profile of uid in one go, the others are
+ * skipped without looking them up. Returns how many are umounted.
+ */
+static int umount_modules(uid_t uid)
+{
+	struct non_root_profile profile;
+	struct try_umount_entry *entry;
+	int count = 0;
+
+	ksu_get_umount_paths(uid, &profile);
+
+	down_read(&try_umount_lock);
+	if (list_empty(&try_umount_list)) {
+		up_read(&try_umount_lock);
+		return umount_legacy_paths(&profile);
+	}
+
+	list_for_each_entry (entry, &try_umount_list, list) {
+		if (is_umount_path(&profile, entry->path)) {
+			count += try_umount(entry->path, entry->sb, true,
+					    entry->flags);
+		}
+	}
+	up_read(&try_umount_lock);
+
+	return count;
+}
+
+static void umount_modules_traced(uid_t uid, bool deferred)
+{
+	u64 start = ktime_get_ns();
+	int count = umount_modules(uid);
+
+	trace_ksu_umount_modules(uid, current->pid, count,
+				 ktime_get_ns() - start, deferred);
+}
+
+#ifdef CONFIG_KSU_ASYNC_UMOUNT
+struct umount_work {
+	struct callback_head cb;
+	// credentials of zygote, the app has dropped the capabilities to umount
+	const struct cred *cred;
+	uid_t uid;
+};
+
+static void umount_work_func(struct callback_head *cb)
+{
+	struct umount_work *work = container_of(cb, struct umount_work, cb);
+	const struct cred *saved = override_creds(work->cred);
+
+	umount_modules_traced(work->uid, true);
+
+	revert_creds(saved);
+	put_cred(work->cred);
+	kfree(work);
+}
+
+// run it when the app returns to userspace, out of the setuid hook, it
+// still runs before any code of the app
+static bool defer_umount_modules(const struct cred *old, uid_t uid)
+{
+	struct umount_work *work = kmalloc(sizeof(*work), GFP_KERNEL);
+
+	if (!work) {
+		return false;
+	}
+
+	init_task_work(&work->cb, umount_work_func);
+	work->cred = get_cred(old);
+	work->uid = uid;
+	if (task_work_add(current, &work->cb, TWA_RESUME)) {
+		// we are exiting, nothing to umount
+		put_cred(work->cred);
+		kfree(work);
+	}
+	return true;
+}
+#endif
+
+void ksu_umount_modules(const struct cred *old, uid_t uid)
+{
+	if (current->nsproxy->mnt_ns == init_nsproxy.mnt_ns) {
+		pr_info("ignore global mnt namespace process: %d\n",
+			current_uid().val);
+		return;
+	}
+
+#ifdef CONFIG_KSU_ASYNC_UMOUNT
+	if (defer_umount_modules(old, uid)) {
+		return;
+	}
+#endif
+
+	umount_modules_traced(uid, false);
+}
+
+void ksu_umount_exit(void)
+{
+	ksu_clear_try_umount();
+}
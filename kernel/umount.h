@@ -0,0 +1,28 @@
+#ifndef __KSU_H_UMOUNT
+#define __KSU_H_UMOUNT
+
+#include "linux/cred.h"
+#include "linux/types.h"
+
+/*
+ * Mount points ksud created for modules, which are unmounted from the mount
+ * namespace of the apps which should not see modules. They are unmounted in
+ * the order they are added, so children must come before their parents.
+ */
+int ksu_add_try_umount(const char *path, int flags);
+
+void ksu_clear_try_umount(void);
+
+/*
+ * Unmount the modules from the mount namespace of current, which is a zygote
+ * child switching from the credentials old to uid. Only the mounts selected by
+ * the umount paths of the profile of uid are unmounted.
+ * With CONFIG_KSU_ASYNC_UMOUNT it is deferred until the child returns to
+ * userspace, out of the setuid hook. The child still does it before running
+ * any code of the app.
+ */
+void ksu_umount_modules(const struct cred *old, uid_t uid);
+
+void ksu_umount_exit(void);
+
+#endif
@@ -4,6 +4,8 @@
 
 #include <android/log.h>
 #include <cstring>
+#include <mutex>
+#include <vector>
 
 #include "ksu.h"
 
@@ -25,19 +27,79 @@ Java_me_weishu_kernelsu_Natives_getVersion(JNIEnv *env, jobject) {
     return get_version();
 }
 
+// the kernel bumps the generation on every change, refetch the list only when it changed
+static std::mutex allowListLock;
+static std::vector<int> allowListCache;
+static uint32_t allowListGeneration = 0;
+
+static bool refreshAllowList() {
+    constexpr uint32_t kPageSize = 256;
+    allow_list_page page = {};
+    page.allow = 1;
+    page.generation = allowListGeneration;
+    std::vector<int> uids;
+    uint32_t generation = 0;
+
+    while (true) {
+        auto offset = uids.size();
+        uids.resize(offset + kPageSize);
+        page.count = kPageSize;
+        page.uids = reinterpret_cast<uintptr_t>(uids.data() + offset);
+        if (!get_allow_list_paged(&page)) {
+            return false;
+        }
+        uids.resize(offset + page.count);
+
+        if (offset == 0) {
+            if (allowListGeneration != 0 && page.generation == allowListGeneration) {
+                // nothing changed
+                return true;
+            }
+            generation = page.generation;
+        } else if (page.generation != generation) {
+            // changed while we are fetching, start over
+            uids.clear();
+            page.cursor = 0;
+            page.generation = 0;
+            continue;
+        }
+
+        if (page.cursor == 0) {
+            break;
+        }
+    }
+
+    allowListCache.swap(uids);
+    allowListGeneration = generation;
+    return true;
+}
+
 extern "C"
 JNIEXPORT jintArray JNICALL
 Java_me_weishu_kernelsu_Natives_getAllowList(JNIEnv *env, jobject) {
-    int uids[1024];
-    int size = 0;
-    bool result = get_allow_list(uids, &size);
-    LOGD("getAllowList: %d, size: %d", result, size);
-    if (result) {
-        auto array = env->NewIntArray(size);
-        env->SetIntArrayRegion(array, 0, size, uids);
-        return array;
+    std::lock_guard<std::mutex> lock(allowListLock);
+    if (!refreshAllowList()) {
+        // old kernel, at most 128 uids are returned
+        int uids[128];
+        int size = 0;
+        bool result = get_allow_list(uids, &size);
+        LOGD("getAllowList: %d, size: %d", result, size);
+        if (!result) {
+            return env->NewIntArray(0);
+        }
+        allowListCache.assign(uids, uids + size);
     }
-    return env->NewIntArray(0);
+
+    auto size = (jsize) allowListCache.size();
+    auto array = env->NewIntArray(size);
+    env->SetIntArrayRegion(array, 0, size, allowListCache.data());
+    return array;
+}
+
+extern "C"
+JNIEXPORT jint JNICALL
+Java_me_weishu_kernelsu_Natives_openAllowListNotifyFd(JNIEnv *env, jobject) {
+    return get_allow_list_notify_fd();
 }
 
 extern "C"
@@ -46,6 +108,12 @@ Java_me_weishu_kernelsu_Natives_isSafeMode(JNIEnv *env, jclass clazz) {
     return is_safe_mode();
 }
 
+extern "C"
+JNIEXPORT jboolean JNICALL
+Java_me_weishu_kernelsu_Natives_isSuEnabled(JNIEnv *env, jclass clazz) {
+    return is_su_enabled();
+}
+
 static void fillIntArray(JNIEnv *env, jobject list, int *data, int count) {
     auto cls = env->GetObjectClass(list);
     auto add = env->GetMethodID(cls, "add", "(Ljava/lang/Object;)Z");
@@ -66,6 +134,15 @@ static void addIntToList(JNIEnv *env, jobject list, int ele) {
     env->CallBooleanMethod(list, add, integer);
 }
 
+static void fillStringList(JNIEnv *env, jobject list, const char (*data)[KSU_UMOUNT_PATH_MAX],
+                           int count) {
+    auto cls = env->GetObjectClass(list);
+    auto add = env->GetMethodID(cls, "add", "(Ljava/lang/Object;)Z");
+    for (int i = 0; i < count; ++i) {
+        env->CallBooleanMethod(list, add, env->NewStringUTF(data[i]));
+    }
+}
+
 static uint64_t capListToBits(JNIEnv *env, jobject list) {
     auto cls = env->GetObjectClass(list);
     auto get = env->GetMethodID(cls, "get", "(I)Ljava/lang/Object;");
@@ -103,26 +180,7 @@ static void fillArrayWithList(JNIEnv *env, jobject list, int *data, int count) {
     }
 }
 
-extern "C"
-JNIEXPORT jobject JNICALL
-Java_me_weishu_kernelsu_Natives_getAppProfile(JNIEnv *env, jobject, jstring pkg, jint uid) {
-    if (env->GetStringLength(pkg) > KSU_MAX_PACKAGE_NAME) {
-        return nullptr;
-    }
-
-    p_key_t key = {};
-    auto cpkg = env->GetStringUTFChars(pkg, nullptr);
-    strcpy(key, cpkg);
-    env->ReleaseStringUTFChars(pkg, cpkg);
-
-    app_profile profile = {};
-    profile.version = KSU_APP_PROFILE_VER;
-
-    strcpy(profile.key, key);
-    profile.current_uid = uid;
-
-    bool useDefaultProfile = !get_app_profile(key, &profile);
-
+static jobject toJavaProfile(JNIEnv *env, const app_profile &profile, bool useDefaultProfile) {
     auto cls = env->FindClass("me/weishu/kernelsu/Natives$Profile");
     auto constructor = env->GetMethodID(cls, "<init>", "()V");
     auto obj = env->NewObject(cls, constructor);
@@ -142,6 +200,7 @@ Java_me_weishu_kernelsu_Natives_getAppProfile(JNIEnv *env, jobject, jstring pkg,
 
     auto nonRootUseDefaultField = env->GetFieldID(cls, "nonRootUseDefault", "Z");
     auto umountModulesField = env->GetFieldID(cls, "umountModules", "Z");
+    auto umountPathsField = env->GetFieldID(cls, "umountPaths", "Ljava/util/List;");
 
     env->SetObjectField(obj, keyField, env->NewStringUTF(profile.key));
     env->SetIntField(obj, currentUidField, profile.current_uid);
@@ -149,7 +208,7 @@ Java_me_weishu_kernelsu_Natives_getAppProfile(JNIEnv *env, jobject, jstring pkg,
     if (useDefaultProfile) {
         // no profile found, so just use default profile:
         // don't allow root and use default profile!
-        LOGD("use default profile for: %s, %d", key, uid);
+        LOGD("use default profile for: %s, %d", profile.key, profile.current_uid);
 
         // allow_su = false
         // non root use default = true
@@ -194,14 +253,62 @@ Java_me_weishu_kernelsu_Natives_getAppProfile(JNIEnv *env, jobject, jstring pkg,
         env->SetBooleanField(obj, nonRootUseDefaultField,
                              (jboolean) profile.nrp_config.use_default);
         env->SetBooleanField(obj, umountModulesField, profile.nrp_config.profile.umount_modules);
+
+        jobject umountPathList = env->GetObjectField(obj, umountPathsField);
+        int umountPathCount = profile.nrp_config.profile.umount_paths_count;
+        if (umountPathCount > KSU_MAX_UMOUNT_PATHS) {
+            umountPathCount = KSU_MAX_UMOUNT_PATHS;
+        }
+        fillStringList(env, umountPathList, profile.nrp_config.profile.umount_paths,
+                       umountPathCount);
     }
 
     return obj;
 }
 
 extern "C"
-JNIEXPORT jboolean JNICALL
-Java_me_weishu_kernelsu_Natives_setAppProfile(JNIEnv *env, jobject clazz, jobject profile) {
+JNIEXPORT jobject JNICALL
+Java_me_weishu_kernelsu_Natives_getAppProfile(JNIEnv *env, jobject, jstring pkg, jint uid) {
+    if (env->GetStringLength(pkg) > KSU_MAX_PACKAGE_NAME) {
+        return nullptr;
+    }
+
+    p_key_t key = {};
+    auto cpkg = env->GetStringUTFChars(pkg, nullptr);
+    strcpy(key, cpkg);
+    env->ReleaseStringUTFChars(pkg, cpkg);
+
+    app_profile profile = {};
+    profile.version = KSU_APP_PROFILE_VER;
+
+    strcpy(profile.key, key);
+    profile.current_uid = uid;
+
+    bool useDefaultProfile = !get_app_profile(key, &profile);
+
+    return toJavaProfile(env, profile, useDefaultProfile);
+}
+
+static bool fillArrayWithStringList(JNIEnv *env, jobject list, char (*data)[KSU_UMOUNT_PATH_MAX],
+                                    int count) {
+    auto cls = env->GetObjectClass(list);
+    auto get = env->GetMethodID(cls, "get", "(I)Ljava/lang/Object;");
+    for (int i = 0; i < count; ++i) {
+        auto str = (jstring) env->CallObjectMethod(list, get, i);
+        auto cstr = env->GetStringUTFChars(str, nullptr);
+        auto fits = strlen(cstr) < KSU_UMOUNT_PATH_MAX;
+        if (fits) {
+            strcpy(data[i], cstr);
+        }
+        env->ReleaseStringUTFChars(str, cstr);
+        if (!fits) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool fromJavaProfile(JNIEnv *env, jobject profile, app_profile &p) {
     auto cls = env->FindClass("me/weishu/kernelsu/Natives$Profile");
 
     auto keyField = env->GetFieldID(cls, "name", "Ljava/lang/String;");
@@ -220,6 +327,7 @@ Java_me_weishu_kernelsu_Natives_setAppProfile(JNIEnv *env, jobject clazz, jobjec
 
     auto nonRootUseDefaultField = env->GetFieldID(cls, "nonRootUseDefault", "Z");
     auto umountModulesField = env->GetFieldID(cls, "umountModules", "Z");
+    auto umountPathsField = env->GetFieldID(cls, "umountPaths", "Ljava/util/List;");
 
     auto key = env->GetObjectField(profile, keyField);
     if (!key) {
@@ -244,7 +352,7 @@ Java_me_weishu_kernelsu_Natives_setAppProfile(JNIEnv *env, jobject clazz, jobjec
     auto allowSu = env->GetBooleanField(profile, allowSuField);
     auto umountModules = env->GetBooleanField(profile, umountModulesField);
 
-    app_profile p = {};
+    memset(&p, 0, sizeof(p));
     p.version = KSU_APP_PROFILE_VER;
 
     strcpy(p.key, p_key);
@@ -281,10 +389,84 @@ Java_me_weishu_kernelsu_Natives_setAppProfile(JNIEnv *env, jobject clazz, jobjec
     } else {
         p.nrp_config.use_default = env->GetBooleanField(profile, nonRootUseDefaultField);
         p.nrp_config.profile.umount_modules = umountModules;
+
+        auto umountPaths = env->GetObjectField(profile, umountPathsField);
+        int umountPathCount = getListSize(env, umountPaths);
+        if (umountPathCount > KSU_MAX_UMOUNT_PATHS) {
+            LOGD("umount paths count too large: %d", umountPathCount);
+            return false;
+        }
+        if (!fillArrayWithStringList(env, umountPaths, p.nrp_config.profile.umount_paths,
+                                     umountPathCount)) {
+            LOGD("umount path too long");
+            return false;
+        }
+        p.nrp_config.profile.umount_paths_count = umountPathCount;
     }
 
+    return true;
+}
+
+extern "C"
+JNIEXPORT jboolean JNICALL
+Java_me_weishu_kernelsu_Natives_setAppProfile(JNIEnv *env, jobject clazz, jobject profile) {
+    app_profile p;
+    if (!fromJavaProfile(env, profile, p)) {
+        return false;
+    }
     return set_app_profile(&p);
 }
+
+extern "C"
+JNIEXPORT jobjectArray JNICALL
+Java_me_weishu_kernelsu_Natives_getAppProfiles(JNIEnv *env, jobject) {
+    // fetch all profiles with as few calls as possible, a page usually holds them all
+    constexpr uint32_t kPageSize = 256;
+    std::vector<app_profile> profiles;
+    app_profile_batch batch = {};
+    do {
+        auto offset = profiles.size();
+        profiles.resize(offset + kPageSize);
+        batch.count = kPageSize;
+        batch.profiles = reinterpret_cast<uintptr_t>(profiles.data() + offset);
+        if (!get_app_profiles(&batch)) {
+            LOGD("getAppProfiles failed, cursor: %u", batch.cursor);
+            return nullptr;
+        }
+        profiles.resize(offset + batch.count);
+    } while (batch.cursor != 0);
+
+    auto cls = env->FindClass("me/weishu/kernelsu/Natives$Profile");
+    auto array = env->NewObjectArray((jsize) profiles.size(), cls, nullptr);
+    for (size_t i = 0; i < profiles.size(); ++i) {
+        env->PushLocalFrame(16);
+        auto obj = env->PopLocalFrame(toJavaProfile(env, profiles[i], false));
+        env->SetObjectArrayElement(array, (jsize) i, obj);
+        env->DeleteLocalRef(obj);
+    }
+    return array;
+}
+
+extern "C"
+JNIEXPORT jint JNICALL
+Java_me_weishu_kernelsu_Natives_setAppProfiles(JNIEnv *env, jobject, jobjectArray array) {
+    auto length = env->GetArrayLength(array);
+    std::vector<app_profile> profiles(length);
+    for (jsize i = 0; i < length; ++i) {
+        auto obj = env->GetObjectArrayElement(array, i);
+        bool ok = fromJavaProfile(env, obj, profiles[i]);
+        env->DeleteLocalRef(obj);
+        if (!ok) {
+            return -1;
+        }
+    }
+
+    app_profile_batch batch = {};
+    batch.count = (uint32_t) length;
+    batch.profiles = reinterpret_cast<uintptr_t>(profiles.data());
+    set_app_profiles(&batch);
+    return (jint) batch.count;
+}
 extern "C"
 JNIEXPORT jboolean JNICALL
 Java_me_weishu_kernelsu_Natives_uidShouldUmount(JNIEnv *env, jobject thiz, jint uid) {
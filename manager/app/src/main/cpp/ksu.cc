@@ -2,6 +2,7 @@
 // Created by weishu on 2022/12/9.
 //
 
+#include <sys/ioctl.h>
 #include <sys/prctl.h>
 #include <stdint.h>
 #include <string.h>
@@ -9,6 +10,7 @@
 #include <unistd.h>
 
 #include "ksu.h"
+#include "profile_tlv.h"
 
 #define KERNEL_SU_OPTION 0xDEADBEEF
 
@@ -28,12 +30,37 @@
 #define CMD_IS_UID_GRANTED_ROOT 12
 #define CMD_IS_UID_SHOULD_UMOUNT 13
 
+#define CMD_GET_APP_PROFILES 14
+#define CMD_SET_APP_PROFILES 15
+#define CMD_GET_ALLOW_LIST_PAGED 16
+#define CMD_GET_ALLOW_LIST_NOTIFY_FD 17
+
+#define CMD_GET_APP_PROFILE_TLV 18
+#define CMD_SET_APP_PROFILE_TLV 19
+
+#define CMD_GET_CONTROL_FD 21
+
+#define CMD_IS_SU_ENABLED 24
+
 static bool ksuctl(int cmd, void* arg1, void* arg2) {
     int32_t result = 0;
     prctl(KERNEL_SU_OPTION, cmd, arg1, arg2, &result);
     return result == KERNEL_SU_OPTION;
 }
 
+// the control fd of the kernel, -1 if it is too old to have one.
+// We must be the manager to get it, so only a successful result is cached.
+static int control_fd() {
+    static int fd = -1;
+    if (fd < 0) {
+        int32_t new_fd = -1;
+        if (ksuctl(CMD_GET_CONTROL_FD, &new_fd, nullptr)) {
+            fd = new_fd;
+        }
+    }
+    return fd;
+}
+
 bool become_manager(const char* pkg) {
     char param[128];
     uid_t uid = getuid();
@@ -59,19 +86,92 @@ bool get_allow_list(int *uids, int *size) {
     return ksuctl(CMD_GET_SU_LIST, uids, size);
 }
 
+bool get_allow_list_paged(allow_list_page *page) {
+    int fd = control_fd();
+    if (fd >= 0) {
+        return ioctl(fd, KSU_IOCTL_GET_ALLOW_LIST, page) == 0;
+    }
+    return ksuctl(CMD_GET_ALLOW_LIST_PAGED, page, nullptr);
+}
+
+int get_allow_list_notify_fd() {
+    int control = control_fd();
+    if (control >= 0) {
+        return ioctl(control, KSU_IOCTL_GET_ALLOW_LIST_NOTIFY_FD);
+    }
+    int32_t fd = -1;
+    if (ksuctl(CMD_GET_ALLOW_LIST_NOTIFY_FD, &fd, nullptr)) {
+        return fd;
+    }
+    return -1;
+}
+
 bool is_safe_mode() {
     return ksuctl(CMD_CHECK_SAFEMODE, nullptr, nullptr);
 }
 
+bool is_su_enabled() {
+    bool enabled = true;
+    // old kernels can't disable it
+    ksuctl(CMD_IS_SU_ENABLED, &enabled, nullptr);
+    return enabled;
+}
+
 bool uid_should_umount(int uid) {
+    int fd = control_fd();
+    if (fd >= 0) {
+        ksu_uid_status status{};
+        status.uid = uid;
+        return ioctl(fd, KSU_IOCTL_GET_UID_STATUS, &status) == 0 &&
+               (status.flags & KSU_UID_SHOULD_UMOUNT);
+    }
     bool should;
     return ksuctl(CMD_IS_UID_SHOULD_UMOUNT, reinterpret_cast<void*>(uid), &should) && should;
 }
 
+// the compact encoding copies a few dozen bytes instead of the whole struct,
+// fall back to the struct for old kernels.
 bool set_app_profile(const app_profile *profile) {
+    uint8_t buf[KSU_PROFILE_TLV_MAX];
+    int len = encode_profile_tlv(profile, buf, sizeof(buf));
+    if (len > 0) {
+        uint32_t size = len;
+        if (ksuctl(CMD_SET_APP_PROFILE_TLV, buf, &size)) {
+            return true;
+        }
+    }
     return ksuctl(CMD_SET_APP_PROFILE, (void*) profile, nullptr);
 }
 
 bool get_app_profile(p_key_t key, app_profile *profile) {
+    uint8_t buf[KSU_PROFILE_TLV_MAX];
+    int len = encode_profile_tlv(profile, buf, sizeof(buf));
+    if (len > 0) {
+        uint32_t size = len;
+        if (ksuctl(CMD_GET_APP_PROFILE_TLV, buf, &size)) {
+            return decode_profile_tlv(buf, size, profile);
+        }
+        if (size == 0) {
+            // the kernel understands it, but there is no such profile
+            return false;
+        }
+    }
     return ksuctl(CMD_GET_APP_PROFILE, (void*) profile, nullptr);
 }
+
+bool get_app_profiles(app_profile_batch *batch) {
+    int fd = control_fd();
+    if (fd >= 0) {
+        return ioctl(fd, KSU_IOCTL_GET_APP_PROFILES, batch) == 0;
+    }
+    return ksuctl(CMD_GET_APP_PROFILES, batch, nullptr);
+}
+
+bool set_app_profiles(app_profile_batch *batch) {
+    int fd = control_fd();
+    if (fd >= 0) {
+        uint32_t count = batch->count;
+        return ioctl(fd, KSU_IOCTL_SET_APP_PROFILES, batch) == 0 && batch->count == count;
+    }
+    return ksuctl(CMD_SET_APP_PROFILES, batch, nullptr);
+}
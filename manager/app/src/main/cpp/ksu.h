@@ -6,6 +6,7 @@
 #define KERNELSU_KSU_H
 
 #include <linux/capability.h>
+#include <linux/ioctl.h>
 
 bool become_manager(const char *);
 
@@ -13,10 +14,32 @@ int get_version();
 
 bool get_allow_list(int *uids, int *size);
 
+struct allow_list_page {
+    // in: generation of the list we have, out: current generation of the list
+    uint32_t generation;
+    // index to start from, updated to where the next call should continue from,
+    // 0 means there are no more uids.
+    uint32_t cursor;
+    // in: capacity of uids, out: number of uids filled
+    uint32_t count;
+    // get the uids allowed to su if non zero, otherwise the denied ones
+    uint32_t allow;
+    // pointer to uint32_t[count]
+    uint64_t uids;
+};
+
+bool get_allow_list_paged(allow_list_page *page);
+
+// returns a fd which becomes readable when the allowlist changed, -1 if unsupported
+int get_allow_list_notify_fd();
+
 bool uid_should_umount(int uid);
 
 bool is_safe_mode();
 
+// whether /system/bin/su works for the apps allowed to su
+bool is_su_enabled();
+
 #define KSU_APP_PROFILE_VER 2
 #define KSU_MAX_PACKAGE_NAME 256
 // NGROUPS_MAX for Linux is 65535 generally, but we only supports 32 groups.
@@ -44,8 +67,14 @@ struct root_profile {
     int32_t namespaces;
 };
 
+#define KSU_MAX_UMOUNT_PATHS 4
+#define KSU_UMOUNT_PATH_MAX 64
+
 struct non_root_profile {
     bool umount_modules;
+    // umount only the mounts at or under these paths, or all of them if it is 0
+    uint8_t umount_paths_count;
+    char umount_paths[KSU_MAX_UMOUNT_PATHS][KSU_UMOUNT_PATH_MAX];
 };
 
 struct app_profile {
@@ -73,8 +102,38 @@ struct app_profile {
     };
 };
 
+struct app_profile_batch {
+    // index of the first profile to get, updated to where the next call should continue from,
+    // 0 means there are no more profiles.
+    uint32_t cursor;
+    // in: capacity of profiles, out: number of profiles got or set
+    uint32_t count;
+    // pointer to app_profile[count]
+    uint64_t profiles;
+};
+
+// ioctl commands of the control fd, see kernel/ksu.h
+struct ksu_uid_status {
+    uint32_t uid;
+    uint32_t flags;
+};
+
+#define KSU_UID_GRANTED_ROOT (1 << 0)
+#define KSU_UID_SHOULD_UMOUNT (1 << 1)
+
+#define KSU_IOCTL_MAGIC 'K'
+#define KSU_IOCTL_GET_UID_STATUS _IOWR(KSU_IOCTL_MAGIC, 5, ksu_uid_status)
+#define KSU_IOCTL_GET_ALLOW_LIST _IOWR(KSU_IOCTL_MAGIC, 6, allow_list_page)
+#define KSU_IOCTL_GET_ALLOW_LIST_NOTIFY_FD _IO(KSU_IOCTL_MAGIC, 7)
+#define KSU_IOCTL_GET_APP_PROFILES _IOWR(KSU_IOCTL_MAGIC, 10, app_profile_batch)
+#define KSU_IOCTL_SET_APP_PROFILES _IOWR(KSU_IOCTL_MAGIC, 11, app_profile_batch)
+
 bool set_app_profile(const app_profile *profile);
 
 bool get_app_profile(p_key_t key, app_profile *profile);
 
+bool get_app_profiles(app_profile_batch *batch);
+
+bool set_app_profiles(app_profile_batch *batch);
+
 #endif //KERNELSU_KSU_H
@@ -0,0 +1,181 @@
+//
+// Variable length encoding of app_profile, keep it in sync with kernel/profile_tlv.c
+//
+
+#include <cstring>
+
+#include "profile_tlv.h"
+
+namespace {
+
+constexpr size_t kHeaderSize = 3; // u8 tag, u16 length
+
+class TlvWriter {
+public:
+    TlvWriter(uint8_t *buf, size_t size) : buf_(buf), size_(size) {}
+
+    void put(uint8_t tag, const void *value, size_t len) {
+        if (overflow_ || off_ + kHeaderSize + len > size_) {
+            overflow_ = true;
+            return;
+        }
+        auto len16 = static_cast<uint16_t>(len);
+        buf_[off_] = tag;
+        memcpy(buf_ + off_ + 1, &len16, sizeof(len16));
+        memcpy(buf_ + off_ + kHeaderSize, value, len);
+        off_ += kHeaderSize + len;
+    }
+
+    void putU8(uint8_t tag, uint8_t value) {
+        if (value) put(tag, &value, sizeof(value));
+    }
+
+    void putS32(uint8_t tag, int32_t value) {
+        if (value) put(tag, &value, sizeof(value));
+    }
+
+    void putString(uint8_t tag, const char *s, size_t max) {
+        auto len = strnlen(s, max);
+        if (len) put(tag, s, len);
+    }
+
+    int finish() const {
+        return overflow_ ? -1 : static_cast<int>(off_);
+    }
+
+private:
+    uint8_t *buf_;
+    size_t size_;
+    size_t off_ = 0;
+    bool overflow_ = false;
+};
+
+bool getString(char *dst, size_t size, const uint8_t *value, uint16_t len) {
+    if (len >= size) return false;
+    memcpy(dst, value, len);
+    dst[len] = '\0';
+    return true;
+}
+
+template<typename T>
+bool getValue(T *dst, const uint8_t *value, uint16_t len) {
+    if (len != sizeof(T)) return false;
+    memcpy(dst, value, len);
+    return true;
+}
+
+}
+
+int encode_profile_tlv(const app_profile *profile, uint8_t *buf, size_t size) {
+    if (size < 1) return -1;
+    buf[0] = KSU_PROFILE_TLV_VERSION;
+
+    TlvWriter w(buf + 1, size - 1);
+    w.put(KSU_TLV_PROFILE_VERSION, &profile->version, sizeof(profile->version));
+    w.putString(KSU_TLV_KEY, profile->key, sizeof(profile->key));
+    w.putS32(KSU_TLV_CURRENT_UID, profile->current_uid);
+    w.putU8(KSU_TLV_ALLOW_SU, profile->allow_su);
+
+    if (profile->allow_su) {
+        auto &rp = profile->rp_config.profile;
+        w.putU8(KSU_TLV_USE_DEFAULT, profile->rp_config.use_default);
+        w.putString(KSU_TLV_TEMPLATE_NAME, profile->rp_config.template_name,
+                    sizeof(profile->rp_config.template_name));
+        w.putS32(KSU_TLV_UID, rp.uid);
+        w.putS32(KSU_TLV_GID, rp.gid);
+        int groups_count = rp.groups_count;
+        if (groups_count > KSU_MAX_GROUPS) groups_count = KSU_MAX_GROUPS;
+        if (groups_count > 0) {
+            w.put(KSU_TLV_GROUPS, rp.groups, groups_count * sizeof(rp.groups[0]));
+        }
+        if (rp.capabilities.effective || rp.capabilities.permitted ||
+            rp.capabilities.inheritable) {
+            w.put(KSU_TLV_CAPABILITIES, &rp.capabilities, sizeof(rp.capabilities));
+        }
+        w.putString(KSU_TLV_SELINUX_DOMAIN, rp.selinux_domain, sizeof(rp.selinux_domain));
+        w.putS32(KSU_TLV_NAMESPACES, rp.namespaces);
+    } else {
+        w.putU8(KSU_TLV_USE_DEFAULT, profile->nrp_config.use_default);
+        w.putU8(KSU_TLV_UMOUNT_MODULES, profile->nrp_config.profile.umount_modules);
+    }
+
+    auto written = w.finish();
+    return written < 0 ? -1 : written + 1;
+}
+
+bool decode_profile_tlv(const uint8_t *buf, size_t len, app_profile *profile) {
+    if (len < 1 || buf[0] != KSU_PROFILE_TLV_VERSION) return false;
+
+    memset(profile, 0, sizeof(*profile));
+    auto &rp = profile->rp_config.profile;
+    size_t off = 1;
+    while (off + kHeaderSize <= len) {
+        uint8_t tag = buf[off];
+        uint16_t size;
+        memcpy(&size, buf + off + 1, sizeof(size));
+        const uint8_t *value = buf + off + kHeaderSize;
+        if (size > len - off - kHeaderSize) return false;
+        off += kHeaderSize + size;
+
+        bool ok = true;
+        switch (tag) {
+            case KSU_TLV_PROFILE_VERSION:
+                ok = getValue(&profile->version, value, size);
+                break;
+            case KSU_TLV_KEY:
+                ok = getString(profile->key, sizeof(profile->key), value, size);
+                break;
+            case KSU_TLV_CURRENT_UID:
+                ok = getValue(&profile->current_uid, value, size);
+                break;
+            case KSU_TLV_ALLOW_SU:
+                ok = size == 1;
+                profile->allow_su = ok && value[0];
+                break;
+            case KSU_TLV_USE_DEFAULT:
+                ok = size == 1;
+                // rp_config and nrp_config both start with use_default
+                profile->rp_config.use_default = ok && value[0];
+                break;
+            case KSU_TLV_TEMPLATE_NAME:
+                ok = profile->allow_su &&
+                     getString(profile->rp_config.template_name,
+                               sizeof(profile->rp_config.template_name), value, size);
+                break;
+            case KSU_TLV_UID:
+                ok = profile->allow_su && getValue(&rp.uid, value, size);
+                break;
+            case KSU_TLV_GID:
+                ok = profile->allow_su && getValue(&rp.gid, value, size);
+                break;
+            case KSU_TLV_GROUPS:
+                ok = profile->allow_su && size <= sizeof(rp.groups) &&
+                     size % sizeof(rp.groups[0]) == 0;
+                if (ok) {
+                    memcpy(rp.groups, value, size);
+                    rp.groups_count = size / sizeof(rp.groups[0]);
+                }
+                break;
+            case KSU_TLV_CAPABILITIES:
+                ok = profile->allow_su && getValue(&rp.capabilities, value, size);
+                break;
+            case KSU_TLV_SELINUX_DOMAIN:
+                ok = profile->allow_su &&
+                     getString(rp.selinux_domain, sizeof(rp.selinux_domain), value, size);
+                break;
+            case KSU_TLV_NAMESPACES:
+                ok = profile->allow_su && getValue(&rp.namespaces, value, size);
+                break;
+            case KSU_TLV_UMOUNT_MODULES:
+                ok = !profile->allow_su && size == 1;
+                profile->nrp_config.profile.umount_modules = ok && value[0];
+                break;
+            default:
+                // added by a newer kernel, ignore it
+                break;
+        }
+        if (!ok) return false;
+    }
+
+    return off == len;
+}
@@ -0,0 +1,36 @@
+//
+// Variable length encoding of app_profile, keep it in sync with kernel/profile_tlv.h
+//
+
+#ifndef KERNELSU_PROFILE_TLV_H
+#define KERNELSU_PROFILE_TLV_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "ksu.h"
+
+#define KSU_PROFILE_TLV_VERSION 1
+
+#define KSU_TLV_PROFILE_VERSION 1
+#define KSU_TLV_KEY 2
+#define KSU_TLV_CURRENT_UID 3
+#define KSU_TLV_ALLOW_SU 4
+#define KSU_TLV_USE_DEFAULT 5
+#define KSU_TLV_TEMPLATE_NAME 6
+#define KSU_TLV_UID 7
+#define KSU_TLV_GID 8
+#define KSU_TLV_GROUPS 9
+#define KSU_TLV_CAPABILITIES 10
+#define KSU_TLV_SELINUX_DOMAIN 11
+#define KSU_TLV_NAMESPACES 12
+#define KSU_TLV_UMOUNT_MODULES 13
+
+#define KSU_PROFILE_TLV_MAX 1024
+
+// returns the encoded size, -1 if buf is too small
+int encode_profile_tlv(const app_profile *profile, uint8_t *buf, size_t size);
+
+bool decode_profile_tlv(const uint8_t *buf, size_t len, app_profile *profile);
+
+#endif //KERNELSU_PROFILE_TLV_H
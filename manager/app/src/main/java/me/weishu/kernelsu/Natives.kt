@@ -39,6 +39,17 @@ object Natives {
     val isSafeMode: Boolean
         external get
 
+    // ksud persists the setting, use setSuEnabled in KsuCli to change it
+    val isSuEnabled: Boolean
+        external get
+
+    /**
+     * Open a fd which becomes readable when the allowlist in kernel is changed,
+     * reading it returns the current generation of the allowlist.
+     * @return -1 if the kernel doesn't support it.
+     */
+    external fun openAllowListNotifyFd(): Int
+
     external fun uidShouldUmount(uid: Int): Boolean
 
     /**
@@ -49,6 +60,18 @@ object Natives {
     external fun getAppProfile(key: String?, uid: Int): Profile
     external fun setAppProfile(profile: Profile?): Boolean
 
+    /**
+     * Get all the profiles stored in kernel with a single call.
+     * @return null if the kernel doesn't support it.
+     */
+    external fun getAppProfiles(): Array<Profile>?
+
+    /**
+     * Set the given profiles with a single call.
+     * @return the count of profiles set, -1 if any of them is invalid.
+     */
+    external fun setAppProfiles(profiles: Array<Profile>): Int
+
     private const val NON_ROOT_DEFAULT_PROFILE_KEY = "$"
     private const val NOBODY_UID = 9999
 
@@ -98,6 +121,8 @@ object Natives {
 
         val nonRootUseDefault: Boolean = true,
         val umountModules: Boolean = true,
+        // only umount the mounts at or under these paths, all of them if it is empty
+        val umountPaths: List<String> = mutableListOf(),
         var rules: String = "", // this field is save in ksud!!
     ) : Parcelable {
         enum class Namespace {
@@ -11,6 +11,7 @@ import androidx.compose.material.icons.filled.BugReport
 import androidx.compose.material.icons.filled.ContactPage
 import androidx.compose.material.icons.filled.Fence
 import androidx.compose.material.icons.filled.RemoveModerator
+import androidx.compose.material.icons.filled.Terminal
 import androidx.compose.material.icons.filled.Update
 import androidx.compose.material.icons.filled.Upgrade
 import androidx.compose.material3.*
@@ -34,6 +35,7 @@ import me.weishu.kernelsu.ui.component.SwitchItem
 import me.weishu.kernelsu.ui.screen.destinations.AppProfileTemplateScreenDestination
 import me.weishu.kernelsu.ui.util.LocalDialogHost
 import me.weishu.kernelsu.ui.util.getBugreportFile
+import me.weishu.kernelsu.ui.util.setSuEnabled
 
 /**
  * @author weishu
@@ -85,6 +87,22 @@ fun SettingScreen(navigator: DestinationsNavigator) {
                 }
             }
 
+            var suEnabled by rememberSaveable {
+                mutableStateOf(Natives.isSuEnabled)
+            }
+            SwitchItem(
+                icon = Icons.Filled.Terminal,
+                title = stringResource(id = R.string.settings_su_compat),
+                summary = stringResource(id = R.string.settings_su_compat_summary),
+                checked = suEnabled
+            ) {
+                scope.launch {
+                    withContext(Dispatchers.IO) { setSuEnabled(it) }
+                    // the hooks may fail to register, show what the kernel has
+                    suEnabled = Natives.isSuEnabled
+                }
+            }
+
             val prefs = context.getSharedPreferences("settings", Context.MODE_PRIVATE)
             var checkUpdate by rememberSaveable {
                 mutableStateOf(
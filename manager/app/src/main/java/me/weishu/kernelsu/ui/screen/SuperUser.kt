@@ -48,6 +48,10 @@ fun SuperUserScreen(navigator: DestinationsNavigator) {
         }
     }
 
+    LaunchedEffect(Unit) {
+        viewModel.watchAllowList()
+    }
+
     Scaffold(
         topBar = {
             SearchAppBar(
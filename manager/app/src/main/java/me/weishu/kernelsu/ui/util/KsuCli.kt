@@ -54,6 +54,10 @@ fun execKsud(args: String): Boolean {
     return ShellUtils.fastCmdResult(shell, "${getKsuDaemonPath()} $args")
 }
 
+fun setSuEnabled(enabled: Boolean): Boolean {
+    return execKsud(if (enabled) "sucompat enable" else "sucompat disable")
+}
+
 fun install() {
     val start = SystemClock.elapsedRealtime()
     val result = execKsud("install")
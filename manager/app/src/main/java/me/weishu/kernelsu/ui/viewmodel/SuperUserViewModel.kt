@@ -6,8 +6,13 @@ import android.content.ServiceConnection
 import android.content.pm.ApplicationInfo
 import android.content.pm.PackageInfo
 import android.os.IBinder
+import android.os.ParcelFileDescriptor
 import android.os.Parcelable
 import android.os.SystemClock
+import android.system.ErrnoException
+import android.system.Os
+import android.system.OsConstants
+import android.system.StructPollfd
 import android.util.Log
 import androidx.compose.runtime.derivedStateOf
 import androidx.compose.runtime.getValue
@@ -16,6 +21,7 @@ import androidx.compose.runtime.setValue
 import androidx.lifecycle.ViewModel
 import com.topjohnwu.superuser.Shell
 import kotlinx.coroutines.Dispatchers
+import kotlinx.coroutines.isActive
 import kotlinx.coroutines.withContext
 import kotlinx.parcelize.Parcelize
 import me.weishu.kernelsu.IKsuInterface
@@ -141,10 +147,16 @@ class SuperUserViewModel : ViewModel() {
 
             val packages = allPackages.list
 
+            val profiles = fetchProfiles()
+
             apps = packages.map {
                 val appInfo = it.applicationInfo
                 val uid = appInfo.uid
-                val profile = Natives.getAppProfile(it.packageName, uid)
+                val profile = if (profiles != null) {
+                    profiles[uid] ?: Natives.Profile(it.packageName, uid)
+                } else {
+                    Natives.getAppProfile(it.packageName, uid)
+                }
                 AppInfo(
                     label = appInfo.loadLabel(pm).toString(),
                     packageInfo = it,
@@ -154,4 +166,48 @@ class SuperUserViewModel : ViewModel() {
             Log.i(TAG, "load cost: ${SystemClock.elapsedRealtime() - start}")
         }
     }
+
+    // kernel matches profiles by uid and the first one wins
+    private fun fetchProfiles(): Map<Int, Natives.Profile>? {
+        return Natives.getAppProfiles()?.reversed()?.associateBy { it.currentUid }
+    }
+
+    /**
+     * Refresh the profiles whenever the allowlist in kernel is changed, e.g. by ksud or by
+     * pruning uninstalled packages, until the calling coroutine is cancelled.
+     */
+    suspend fun watchAllowList() = withContext(Dispatchers.IO) {
+        val fd = Natives.openAllowListNotifyFd()
+        if (fd < 0) {
+            return@withContext
+        }
+
+        ParcelFileDescriptor.adoptFd(fd).use { pfd ->
+            val pollFd = StructPollfd().apply {
+                this.fd = pfd.fileDescriptor
+                events = OsConstants.POLLIN.toShort()
+            }
+            val generation = ByteArray(4)
+            while (isActive) {
+                try {
+                    // wake up now and then to check if we are cancelled
+                    if (Os.poll(arrayOf(pollFd), 1000) <= 0) {
+                        continue
+                    }
+                    Os.read(pfd.fileDescriptor, generation, 0, generation.size)
+                } catch (e: ErrnoException) {
+                    if (e.errno == OsConstants.EINTR || e.errno == OsConstants.EAGAIN) {
+                        continue
+                    }
+                    Log.w(TAG, "watch allowlist failed", e)
+                    break
+                }
+
+                val profiles = fetchProfiles() ?: break
+                apps = apps.map {
+                    it.copy(profile = profiles[it.uid] ?: Natives.Profile(it.packageName, it.uid))
+                }
+            }
+        }
+    }
 }
@@ -7,7 +7,7 @@ use android_logger::Config;
 #[cfg(target_os = "android")]
 use log::LevelFilter;
 
-use crate::{apk_sign, debug, defs, event, module, utils};
+use crate::{apk_sign, debug, defs, event, module, sucompat, utils};
 
 /// KernelSU userspace cli
 #[derive(Parser, Debug)]
@@ -49,6 +49,12 @@ enum Commands {
         command: Profile,
     },
 
+    /// Enable or disable `/system/bin/su` for the apps allowed to su, the setting persists
+    Sucompat {
+        #[command(subcommand)]
+        command: Sucompat,
+    },
+
     /// Patch boot or init_boot images to apply KernelSU
     BootPatch {
         /// boot image path, if not specified, will try to find the boot image automatically
@@ -127,10 +133,33 @@ enum Debug {
         punch_hole: bool,
     },
 
+    /// Measure the latency of stat() and faccessat(), compare it on kernels with and without
+    /// KernelSU, or between uids allowed and not allowed to su, to see the cost of sucompat.
+    Bench {
+        /// path to stat
+        #[arg(default_value_t = String::from("/system/bin/sh"))]
+        path: String,
+        /// number of calls to measure
+        #[arg(short, long, default_value_t = 1_000_000)]
+        iterations: u32,
+    },
+
     /// For testing
     Test,
 }
 
+#[derive(clap::Subcommand, Debug)]
+enum Sucompat {
+    /// Enable the su compatibility hooks
+    Enable,
+
+    /// Disable the su compatibility hooks, to save their cost on every execve, stat and faccessat
+    Disable,
+
+    /// Print whether it is enabled
+    Status,
+}
+
 #[derive(clap::Subcommand, Debug)]
 enum Sepolicy {
     /// Patch sepolicy
@@ -283,6 +312,15 @@ pub fn run() -> Result<()> {
             Profile::ListTemplates => crate::profile::list_templates(),
         },
 
+        Commands::Sucompat { command } => match command {
+            Sucompat::Enable => sucompat::set_enabled(true),
+            Sucompat::Disable => sucompat::set_enabled(false),
+            Sucompat::Status => {
+                println!("{}", crate::ksu::is_sucompat_enabled()?);
+                Ok(())
+            }
+        },
+
         Commands::Debug { command } => match command {
             Debug::SetManager { apk } => debug::set_manager(&apk),
             Debug::GetSign { apk } => {
@@ -304,6 +342,7 @@ pub fn run() -> Result<()> {
                 utils::copy_sparse_file(src, dst, punch_hole)?;
                 Ok(())
             }
+            Debug::Bench { path, iterations } => debug::bench_stat(&path, iterations),
             Debug::Test => todo!(),
         },
 
@@ -2,6 +2,7 @@ use anyhow::{ensure, Context, Ok, Result};
 use std::{
     path::{Path, PathBuf},
     process::Command,
+    time::{Duration, Instant},
 };
 
 use crate::apk_sign::get_apk_signature;
@@ -63,3 +64,40 @@ pub fn set_manager(pkg: &str) -> Result<()> {
     let _ = Command::new("am").args(["force-stop", pkg]).status();
     Ok(())
 }
+
+fn bench<F: FnMut()>(name: &str, iterations: u32, mut f: F) {
+    // warm up the caches, so that the first calls are not measured
+    for _ in 0..iterations / 100 {
+        f();
+    }
+
+    // the best of a few rounds, to filter out the noise of preemption
+    let mut best = Duration::MAX;
+    for _ in 0..5 {
+        let start = Instant::now();
+        for _ in 0..iterations {
+            f();
+        }
+        best = best.min(start.elapsed());
+    }
+
+    let ns = best.as_nanos() as f64 / f64::from(iterations);
+    println!("{name}: {ns:.1} ns/call");
+}
+
+pub fn bench_stat(path: &str, iterations: u32) -> Result<()> {
+    ensure!(iterations > 0, "iterations must be positive");
+    rustix::fs::stat(path).with_context(|| format!("stat {path}"))?;
+
+    println!(
+        "uid: {}, {iterations} calls of {path}",
+        rustix::process::getuid().as_raw()
+    );
+    bench("stat", iterations, || {
+        let _ = rustix::fs::stat(path);
+    });
+    bench("faccessat", iterations, || {
+        let _ = rustix::fs::access(path, rustix::fs::Access::EXISTS);
+    });
+    Ok(())
+}
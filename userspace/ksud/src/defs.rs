@@ -9,7 +9,12 @@ pub const PROFILE_DIR: &str = concatcp!(WORKING_DIR, "profile/");
 pub const PROFILE_SELINUX_DIR: &str = concatcp!(PROFILE_DIR, "selinux/");
 pub const PROFILE_TEMPLATE_DIR: &str = concatcp!(PROFILE_DIR, "templates/");
 
+// default selinux domain of root profiles
+pub const KERNEL_SU_DOMAIN: &str = "u:r:su:s0";
+
 pub const KSURC_PATH: &str = concatcp!(WORKING_DIR, ".ksurc");
+// the su compatibility hooks are disabled at boot if it exists
+pub const SUCOMPAT_DISABLE_FILE: &str = concatcp!(WORKING_DIR, ".sucompat_disable");
 pub const KSU_OVERLAY_SOURCE: &str = "KSU";
 pub const DAEMON_PATH: &str = concatcp!(ADB_DIR, "ksud");
 
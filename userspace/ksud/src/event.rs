@@ -118,6 +118,9 @@ pub fn on_post_data_fs() -> Result<()> {
         // becuase we may need to operate the module dir in safe mode
         warn!("safe mode, skip common post-fs-data.d scripts");
     } else {
+        // keep su working in safe mode, it may be needed to rescue the device
+        crate::sucompat::apply_config();
+
         // Then exec common post-fs-data scripts
         if let Err(e) = crate::module::exec_common_scripts("post-fs-data.d", true) {
             warn!("exec common post-fs-data scripts failed: {}", e);
@@ -211,6 +214,11 @@ pub fn on_post_data_fs() -> Result<()> {
         warn!("do systemless mount failed: {}", e);
     }
 
+    // let kernel umount exactly what we have mounted, including system_ext and odm
+    if let Err(e) = mount::register_try_umount(&[defs::MODULE_DIR]) {
+        warn!("register try umount failed: {}", e);
+    }
+
     run_stage("post-mount", true);
 
     std::env::set_current_dir("/").with_context(|| "failed to chdir to /")?;
@@ -332,6 +332,163 @@ pub fn check_kernel_safemode() -> bool {
     false
 }
 
+pub const KSU_MAX_PACKAGE_NAME: usize = 256;
+pub const KSU_MAX_GROUPS: usize = 32;
+pub const KSU_SELINUX_DOMAIN: usize = 64;
+
+// struct root_profile of kernel/ksu.h
+#[repr(C)]
+pub struct RootProfile {
+    pub uid: i32,
+    pub gid: i32,
+    pub groups_count: i32,
+    pub groups: [i32; KSU_MAX_GROUPS],
+    pub capabilities: Capabilities,
+    pub selinux_domain: [u8; KSU_SELINUX_DOMAIN],
+    pub namespaces: i32,
+}
+
+#[repr(C)]
+#[derive(Default)]
+pub struct Capabilities {
+    pub effective: u64,
+    pub permitted: u64,
+    pub inheritable: u64,
+}
+
+// struct root_profile_template of kernel/ksu.h
+#[repr(C)]
+struct RootProfileTemplate {
+    name: [u8; KSU_MAX_PACKAGE_NAME],
+    profile: RootProfile,
+}
+
+/// Update the root profile of every app using the template `name` in kernel.
+#[cfg(any(target_os = "linux", target_os = "android"))]
+pub fn set_root_profile_template(name: &str, profile: RootProfile) -> Result<()> {
+    const KERNEL_SU_OPTION: u32 = 0xDEAD_BEEF;
+    const CMD_SET_ROOT_PROFILE_TEMPLATE: u64 = 20;
+
+    anyhow::ensure!(
+        !name.is_empty() && name.len() < KSU_MAX_PACKAGE_NAME,
+        "invalid template name: {name}"
+    );
+    let mut template = RootProfileTemplate {
+        name: [0; KSU_MAX_PACKAGE_NAME],
+        profile,
+    };
+    template.name[..name.len()].copy_from_slice(name.as_bytes());
+
+    let mut result: u32 = 0;
+    unsafe {
+        #[allow(clippy::cast_possible_wrap)]
+        libc::prctl(
+            KERNEL_SU_OPTION as i32, // supposed to overflow
+            CMD_SET_ROOT_PROFILE_TEMPLATE,
+            std::ptr::addr_of!(template),
+            0,
+            std::ptr::addr_of_mut!(result).cast::<libc::c_void>(),
+        );
+    }
+
+    anyhow::ensure!(
+        result == KERNEL_SU_OPTION,
+        "set root profile template failed"
+    );
+    Ok(())
+}
+
+#[cfg(not(any(target_os = "linux", target_os = "android")))]
+pub fn set_root_profile_template(_name: &str, _profile: RootProfile) -> Result<()> {
+    Ok(())
+}
+
+/// Tell kernel to umount `path` for the apps which should not see modules,
+/// `None` forgets all of the paths added before.
+#[cfg(any(target_os = "linux", target_os = "android"))]
+pub fn add_try_umount(path: Option<&str>, flags: u32) -> Result<()> {
+    const KERNEL_SU_OPTION: u32 = 0xDEAD_BEEF;
+    const CMD_ADD_TRY_UMOUNT: u64 = 22;
+
+    let path = path.map(std::ffi::CString::new).transpose()?;
+    let path_ptr = path.as_ref().map_or(std::ptr::null(), |p| p.as_ptr());
+
+    let mut result: u32 = 0;
+    unsafe {
+        #[allow(clippy::cast_possible_wrap)]
+        libc::prctl(
+            KERNEL_SU_OPTION as i32, // supposed to overflow
+            CMD_ADD_TRY_UMOUNT,
+            path_ptr,
+            u64::from(flags),
+            std::ptr::addr_of_mut!(result).cast::<libc::c_void>(),
+        );
+    }
+
+    anyhow::ensure!(result == KERNEL_SU_OPTION, "add try umount failed");
+    Ok(())
+}
+
+#[cfg(not(any(target_os = "linux", target_os = "android")))]
+pub fn add_try_umount(_path: Option<&str>, _flags: u32) -> Result<()> {
+    Ok(())
+}
+
+/// Register or unregister the su compatibility hooks of kernel, which make
+/// `/system/bin/su` work for the apps allowed to su.
+#[cfg(any(target_os = "linux", target_os = "android"))]
+pub fn set_sucompat(enabled: bool) -> Result<()> {
+    const KERNEL_SU_OPTION: u32 = 0xDEAD_BEEF;
+    const CMD_ENABLE_SU: u64 = 23;
+
+    let mut result: u32 = 0;
+    unsafe {
+        #[allow(clippy::cast_possible_wrap)]
+        libc::prctl(
+            KERNEL_SU_OPTION as i32, // supposed to overflow
+            CMD_ENABLE_SU,
+            u64::from(enabled),
+            0,
+            std::ptr::addr_of_mut!(result).cast::<libc::c_void>(),
+        );
+    }
+
+    anyhow::ensure!(result == KERNEL_SU_OPTION, "set sucompat failed");
+    Ok(())
+}
+
+#[cfg(not(any(target_os = "linux", target_os = "android")))]
+pub fn set_sucompat(_enabled: bool) -> Result<()> {
+    Ok(())
+}
+
+#[cfg(any(target_os = "linux", target_os = "android"))]
+pub fn is_sucompat_enabled() -> Result<bool> {
+    const KERNEL_SU_OPTION: u32 = 0xDEAD_BEEF;
+    const CMD_IS_SU_ENABLED: u64 = 24;
+
+    let mut enabled = false;
+    let mut result: u32 = 0;
+    unsafe {
+        #[allow(clippy::cast_possible_wrap)]
+        libc::prctl(
+            KERNEL_SU_OPTION as i32, // supposed to overflow
+            CMD_IS_SU_ENABLED,
+            std::ptr::addr_of_mut!(enabled),
+            0,
+            std::ptr::addr_of_mut!(result).cast::<libc::c_void>(),
+        );
+    }
+
+    anyhow::ensure!(result == KERNEL_SU_OPTION, "get sucompat failed");
+    Ok(enabled)
+}
+
+#[cfg(not(any(target_os = "linux", target_os = "android")))]
+pub fn is_sucompat_enabled() -> Result<bool> {
+    Ok(true)
+}
+
 pub fn report_post_fs_data() {
     report_event(EVENT_POST_FS_DATA);
 }
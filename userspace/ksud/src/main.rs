@@ -9,8 +9,10 @@ mod ksu;
 mod module;
 mod mount;
 mod profile;
+mod profile_defs;
 mod restorecon;
 mod sepolicy;
+mod sucompat;
 mod utils;
 
 fn main() -> anyhow::Result<()> {
@@ -297,6 +297,51 @@ pub fn mount_overlay(
     Ok(())
 }
 
+/// Register the mounts made for modules to kernel, so that they can be
+/// umounted for the apps which should not see modules. Overlays are
+/// umounted normally, the others (tmpfs, module image) are detached.
+#[cfg(any(target_os = "linux", target_os = "android"))]
+pub fn register_try_umount(extra: &[&str]) -> Result<()> {
+    let mounts = Process::myself()?
+        .mountinfo()
+        .with_context(|| "get mountinfo")?;
+
+    let mut targets = mounts
+        .0
+        .iter()
+        .filter(|m| m.mount_source.as_deref() == Some(KSU_OVERLAY_SOURCE))
+        .filter_map(|m| {
+            let flags = if m.fs_type == "overlay" {
+                0
+            } else {
+                libc::MNT_DETACH as u32
+            };
+            m.mount_point.to_str().map(|p| (p.to_string(), flags))
+        })
+        .collect::<Vec<_>>();
+    for path in extra {
+        let path = path.trim_end_matches('/');
+        if mounts.0.iter().any(|m| m.mount_point == Path::new(path)) {
+            targets.push((path.to_string(), libc::MNT_DETACH as u32));
+        }
+    }
+
+    // children must be umounted before their parents, the same paths end up
+    // next to each other for dedup, keeping the first one as the sort is stable
+    let depth = |path: &str| Path::new(path).components().count();
+    targets.sort_by(|(a, _), (b, _)| depth(b).cmp(&depth(a)).then_with(|| a.cmp(b)));
+    targets.dedup_by(|a, b| a.0 == b.0);
+
+    crate::ksu::add_try_umount(None, 0)?;
+    for (path, flags) in targets {
+        info!("register try umount: {path}");
+        if let Err(e) = crate::ksu::add_try_umount(Some(&path), flags) {
+            warn!("register try umount {path} failed: {e}");
+        }
+    }
+    Ok(())
+}
+
 #[cfg(not(any(target_os = "linux", target_os = "android")))]
 pub fn mount_ext4(_src: &str, _target: &str, _autodrop: bool) -> Result<()> {
     unimplemented!()
@@ -317,6 +362,11 @@ pub fn mount_overlay(
     unimplemented!()
 }
 
+#[cfg(not(any(target_os = "linux", target_os = "android")))]
+pub fn register_try_umount(_extra: &[&str]) -> Result<()> {
+    Ok(())
+}
+
 #[cfg(not(any(target_os = "linux", target_os = "android")))]
 pub fn mount_tmpfs(_dest: impl AsRef<Path>) -> Result<()> {
     unimplemented!()
@@ -1,6 +1,8 @@
+use crate::ksu::{self, RootProfile};
+use crate::profile_defs::{CAPABILITIES, GROUPS};
 use crate::utils::ensure_dir_exists;
 use crate::{defs, sepolicy};
-use anyhow::{Context, Result};
+use anyhow::{bail, Context, Result};
 use std::path::Path;
 
 pub fn set_sepolicy(pkg: String, policy: String) -> Result<()> {
@@ -21,11 +23,99 @@ pub fn get_sepolicy(pkg: String) -> Result<()> {
 // ksud doesn't guarteen the correctness of template, it just save
 pub fn set_template(id: String, template: String) -> Result<()> {
     ensure_dir_exists(defs::PROFILE_TEMPLATE_DIR)?;
-    let template_file = Path::new(defs::PROFILE_TEMPLATE_DIR).join(id);
-    std::fs::write(template_file, template)?;
+    let template_file = Path::new(defs::PROFILE_TEMPLATE_DIR).join(&id);
+    std::fs::write(template_file, &template)?;
+    // apps using the template in kernel get the new profile right now
+    if let Err(e) = parse_template(&template).and_then(|p| ksu::set_root_profile_template(&id, p)) {
+        log::warn!("apply template {id} to kernel failed: {e}");
+    }
     Ok(())
 }
 
+fn lookup(table: &[(&str, u32)], name: &str) -> Result<u32> {
+    table
+        .iter()
+        .find(|(n, _)| *n == name)
+        .map(|(_, v)| *v)
+        .with_context(|| format!("unknown name: {name}"))
+}
+
+fn json_names(json: &serde_json::Value, key: &str) -> Result<Vec<String>> {
+    let Some(names) = json.get(key) else {
+        return Ok(Vec::new());
+    };
+    let Some(names) = names.as_array() else {
+        bail!("{key} is not an array");
+    };
+    names
+        .iter()
+        .map(|n| n.as_str().map(str::to_owned).context("not a string"))
+        .collect()
+}
+
+// mirror of fromJSON in the manager's TemplateViewModel.kt
+fn parse_template(template: &str) -> Result<RootProfile> {
+    let json: serde_json::Value = serde_json::from_str(template)?;
+    let int = |key: &str| -> Result<i32> {
+        json.get(key)
+            .and_then(serde_json::Value::as_i64)
+            .map_or(Ok(0), |v| {
+                i32::try_from(v).with_context(|| format!("invalid {key}: {v}"))
+            })
+    };
+
+    let mut profile = RootProfile {
+        uid: int("uid")?,
+        gid: int("gid")?,
+        groups_count: 0,
+        groups: [0; ksu::KSU_MAX_GROUPS],
+        capabilities: ksu::Capabilities::default(),
+        selinux_domain: [0; ksu::KSU_SELINUX_DOMAIN],
+        namespaces: 0,
+    };
+
+    let groups = json_names(&json, "groups")?;
+    if groups.len() > ksu::KSU_MAX_GROUPS {
+        bail!("too many groups: {}", groups.len());
+    }
+    for (i, group) in groups.iter().enumerate() {
+        #[allow(clippy::cast_possible_wrap)]
+        let gid = lookup(GROUPS, group)? as i32;
+        profile.groups[i] = gid;
+    }
+    #[allow(clippy::cast_possible_truncation, clippy::cast_possible_wrap)]
+    let groups_count = groups.len() as i32;
+    profile.groups_count = groups_count;
+
+    // kernel uses the effective set for all the others
+    for cap in json_names(&json, "capabilities")? {
+        profile.capabilities.effective |= 1u64 << lookup(CAPABILITIES, &cap)?;
+    }
+
+    let context = json
+        .get("context")
+        .and_then(serde_json::Value::as_str)
+        .filter(|c| !c.is_empty())
+        .unwrap_or(defs::KERNEL_SU_DOMAIN);
+    if context.len() >= ksu::KSU_SELINUX_DOMAIN {
+        bail!("context too long: {context}");
+    }
+    profile.selinux_domain[..context.len()].copy_from_slice(context.as_bytes());
+
+    let namespace = json
+        .get("namespace")
+        .and_then(serde_json::Value::as_str)
+        .unwrap_or("INHERITED");
+    profile.namespaces = match namespace.to_uppercase().as_str() {
+        "" | "INHERITED" => 0,
+        "GLOBAL" => 1,
+        "INDIVIDUAL" => 2,
+        _ => bail!("unknown namespace: {namespace}"),
+    };
+
+    Ok(profile)
+}
+
 pub fn get_template(id: String) -> Result<()> {
     let template_file = Path::new(defs::PROFILE_TEMPLATE_DIR).join(id);
     let template = std::fs::read_to_string(template_file)?;
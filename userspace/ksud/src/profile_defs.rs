@@ -0,0 +1,165 @@
+// Keep in sync with manager/app/src/main/java/me/weishu/kernelsu/profile/Groups.kt and
+// Capabilities.kt, templates refer to them by name.
+
+pub const GROUPS: &[(&str, u32)] = &[
+    ("ROOT", 0),
+    ("DAEMON", 1),
+    ("BIN", 2),
+    ("SYS", 3),
+    ("SYSTEM", 1000),
+    ("RADIO", 1001),
+    ("BLUETOOTH", 1002),
+    ("GRAPHICS", 1003),
+    ("INPUT", 1004),
+    ("AUDIO", 1005),
+    ("CAMERA", 1006),
+    ("LOG", 1007),
+    ("COMPASS", 1008),
+    ("MOUNT", 1009),
+    ("WIFI", 1010),
+    ("ADB", 1011),
+    ("INSTALL", 1012),
+    ("MEDIA", 1013),
+    ("DHCP", 1014),
+    ("SDCARD_RW", 1015),
+    ("VPN", 1016),
+    ("KEYSTORE", 1017),
+    ("USB", 1018),
+    ("DRM", 1019),
+    ("MDNSR", 1020),
+    ("GPS", 1021),
+    ("UNUSED1", 1022),
+    ("MEDIA_RW", 1023),
+    ("MTP", 1024),
+    ("UNUSED2", 1025),
+    ("DRMRPC", 1026),
+    ("NFC", 1027),
+    ("SDCARD_R", 1028),
+    ("CLAT", 1029),
+    ("LOOP_RADIO", 1030),
+    ("MEDIA_DRM", 1031),
+    ("PACKAGE_INFO", 1032),
+    ("SDCARD_PICS", 1033),
+    ("SDCARD_AV", 1034),
+    ("SDCARD_ALL", 1035),
+    ("LOGD", 1036),
+    ("SHARED_RELRO", 1037),
+    ("DBUS", 1038),
+    ("TLSDATE", 1039),
+    ("MEDIA_EX", 1040),
+    ("AUDIOSERVER", 1041),
+    ("METRICS_COLL", 1042),
+    ("METRICSD", 1043),
+    ("WEBSERV", 1044),
+    ("DEBUGGERD", 1045),
+    ("MEDIA_CODEC", 1046),
+    ("CAMERASERVER", 1047),
+    ("FIREWALL", 1048),
+    ("TRUNKS", 1049),
+    ("NVRAM", 1050),
+    ("DNS", 1051),
+    ("DNS_TETHER", 1052),
+    ("WEBVIEW_ZYGOTE", 1053),
+    ("VEHICLE_NETWORK", 1054),
+    ("MEDIA_AUDIO", 1055),
+    ("MEDIA_VIDEO", 1056),
+    ("MEDIA_IMAGE", 1057),
+    ("TOMBSTONED", 1058),
+    ("MEDIA_OBB", 1059),
+    ("ESE", 1060),
+    ("OTA_UPDATE", 1061),
+    ("AUTOMOTIVE_EVS", 1062),
+    ("LOWPAN", 1063),
+    ("HSM", 1064),
+    ("RESERVED_DISK", 1065),
+    ("STATSD", 1066),
+    ("INCIDENTD", 1067),
+    ("SECURE_ELEMENT", 1068),
+    ("LMKD", 1069),
+    ("LLKD", 1070),
+    ("IORAPD", 1071),
+    ("GPU_SERVICE", 1072),
+    ("NETWORK_STACK", 1073),
+    ("GSID", 1074),
+    ("FSVERITY_CERT", 1075),
+    ("CREDSTORE", 1076),
+    ("EXTERNAL_STORAGE", 1077),
+    ("EXT_DATA_RW", 1078),
+    ("EXT_OBB_RW", 1079),
+    ("CONTEXT_HUB", 1080),
+    ("VIRTUALIZATIONSERVICE", 1081),
+    ("ARTD", 1082),
+    ("UWB", 1083),
+    ("THREAD_NETWORK", 1084),
+    ("DICED", 1085),
+    ("DMESGD", 1086),
+    ("JC_WEAVER", 1087),
+    ("JC_STRONGBOX", 1088),
+    ("JC_IDENTITYCRED", 1089),
+    ("SDK_SANDBOX", 1090),
+    ("SECURITY_LOG_WRITER", 1091),
+    ("PRNG_SEEDER", 1092),
+    ("SHELL", 2000),
+    ("CACHE", 2001),
+    ("DIAG", 2002),
+    ("NET_BT_ADMIN", 3001),
+    ("NET_BT", 3002),
+    ("INET", 3003),
+    ("NET_RAW", 3004),
+    ("NET_ADMIN", 3005),
+    ("NET_BW_STATS", 3006),
+    ("NET_BW_ACCT", 3007),
+    ("NET_BT_STACK", 3008),
+    ("READPROC", 3009),
+    ("WAKELOCK", 3010),
+    ("UHID", 3011),
+    ("READTRACEFS", 3012),
+    ("EVERYBODY", 9997),
+    ("MISC", 9998),
+    ("NOBODY", 9999),
+    ("APP", 10000),
+];
+
+pub const CAPABILITIES: &[(&str, u32)] = &[
+    ("CAP_CHOWN", 0),
+    ("CAP_DAC_OVERRIDE", 1),
+    ("CAP_DAC_READ_SEARCH", 2),
+    ("CAP_FOWNER", 3),
+    ("CAP_FSETID", 4),
+    ("CAP_KILL", 5),
+    ("CAP_SETGID", 6),
+    ("CAP_SETUID", 7),
+    ("CAP_SETPCAP", 8),
+    ("CAP_LINUX_IMMUTABLE", 9),
+    ("CAP_NET_BIND_SERVICE", 10),
+    ("CAP_NET_BROADCAST", 11),
+    ("CAP_NET_ADMIN", 12),
+    ("CAP_NET_RAW", 13),
+    ("CAP_IPC_LOCK", 14),
+    ("CAP_IPC_OWNER", 15),
+    ("CAP_SYS_MODULE", 16),
+    ("CAP_SYS_RAWIO", 17),
+    ("CAP_SYS_CHROOT", 18),
+    ("CAP_SYS_PTRACE", 19),
+    ("CAP_SYS_PACCT", 20),
+    ("CAP_SYS_ADMIN", 21),
+    ("CAP_SYS_BOOT", 22),
+    ("CAP_SYS_NICE", 23),
+    ("CAP_SYS_RESOURCE", 24),
+    ("CAP_SYS_TIME", 25),
+    ("CAP_SYS_TTY_CONFIG", 26),
+    ("CAP_MKNOD", 27),
+    ("CAP_LEASE", 28),
+    ("CAP_AUDIT_WRITE", 29),
+    ("CAP_AUDIT_CONTROL", 30),
+    ("CAP_SETFCAP", 31),
+    ("CAP_MAC_OVERRIDE", 32),
+    ("CAP_MAC_ADMIN", 33),
+    ("CAP_SYSLOG", 34),
+    ("CAP_WAKE_ALARM", 35),
+    ("CAP_BLOCK_SUSPEND", 36),
+    ("CAP_AUDIT_READ", 37),
+    ("CAP_PERFMON", 38),
+    ("CAP_BPF", 39),
+    ("CAP_CHECKPOINT_RESTORE", 40),
+];
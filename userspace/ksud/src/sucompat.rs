@@ -0,0 +1,48 @@
+use anyhow::{bail, Context, Result};
+use log::{info, warn};
+use std::{path::Path, time::Duration};
+
+use crate::{defs, ksu, utils};
+
+/// Enable or disable the su compatibility hooks of kernel now and on the next boots.
+pub fn set_enabled(enabled: bool) -> Result<()> {
+    let disable_file = Path::new(defs::SUCOMPAT_DISABLE_FILE);
+    if enabled {
+        if disable_file.exists() {
+            std::fs::remove_file(disable_file)
+                .with_context(|| format!("failed to remove {}", disable_file.display()))?;
+        }
+    } else {
+        utils::ensure_file_exists(disable_file)?;
+    }
+
+    ksu::set_sucompat(enabled)?;
+    wait_for_state(enabled)
+}
+
+/// The kernel registers or unregisters the hooks from its work queue, wait for
+/// it to be done, so that the status reported after this is the new one.
+fn wait_for_state(enabled: bool) -> Result<()> {
+    for _ in 0..20 {
+        if ksu::is_sucompat_enabled()? == enabled {
+            return Ok(());
+        }
+        std::thread::sleep(Duration::from_millis(50));
+    }
+    bail!(
+        "the su compatibility hooks are still {}, check the kernel log",
+        if enabled { "disabled" } else { "enabled" }
+    )
+}
+
+/// Apply the setting at boot, the hooks are registered by kernel by default.
+pub fn apply_config() {
+    if !Path::new(defs::SUCOMPAT_DISABLE_FILE).exists() {
+        return;
+    }
+
+    info!("disable sucompat");
+    if let Err(e) = ksu::set_sucompat(false) {
+        warn!("disable sucompat failed: {e}");
+    }
+}